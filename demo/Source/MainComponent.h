@@ -4,7 +4,17 @@
 
 #include "HeadMatrix.h"
 #include "Tracker.h"
+#include "FirmwareTransfer.h"
+#include "FrameClock.h"
+#include "TrackerSimulator.h"
+#include "GazeTargets.h"
+#include "AmbisonicMatrix.h"
+#include "VbapLayout.h"
+#include "Interaural.h"
+#include "LatencyHistogram.h"
+#include "MotionRate.h"
 #include "midi.h"
+#include "audio.h"
 #include "configPanel.h"
 #include "headPanel.h"
 
@@ -0,0 +1,196 @@
+/*
+ * Ambisonic rotation matrix: spherical harmonic rotation from head orientation
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/** Builds the block-diagonal matrix that rotates a real-valued Ambisonic
+    sound field (ACN channel order, SN3D or N3D: the blocks are the same for
+    both) by the same world-to-head rotation as HeadMatrix::transformTranspose.
+    Each order has its own (2l+1) x (2l+1) block, stored row-major; order 0
+    (the W channel) never changes. Blocks are derived with the Ivanic and
+    Ruedenberg recursion. */
+class AmbisonicMatrix
+{
+public:
+    static constexpr int MaxOrder = 5;
+
+    AmbisonicMatrix()
+    {
+        float eye[9] = { 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f };
+        setRotation(eye);
+    }
+
+    // --------------------------------------------------------------------
+
+    static constexpr int getNumChannels(const int order)
+    {
+        return (order + 1) * (order + 1);
+    }
+
+    // --------------------------------------------------------------------
+
+    /** First ACN channel of an order. */
+    static constexpr int getFirstChannel(const int order)
+    {
+        return order * order;
+    }
+
+    // --------------------------------------------------------------------
+
+    /** Row-major rotation block for an order between 1 and MaxOrder. */
+    const float* getOrderMatrix(const int order) const
+    {
+        return &coefficients[blockOffset(order)];
+    }
+
+    // --------------------------------------------------------------------
+
+    /** Takes the head tracker's orientation. A room-fixed sound field is
+        rotated into head-relative coordinates. */
+    void setOrientation(const HeadMatrix& headMatrix)
+    {
+        // HeadMatrix uses x = right, y = forward, z = up; Ambisonics uses
+        // X = forward, Y = left, Z = up. The world-to-head rotation is the
+        // transpose of the head matrix, with its axes relabelled.
+        const float* m = headMatrix.getMatrix();
+        float r[9];
+        r[0] =  m[4]; r[1] = -m[1]; r[2] =  m[7];
+        r[3] = -m[3]; r[4] =  m[0]; r[5] = -m[6];
+        r[6] =  m[5]; r[7] = -m[2]; r[8] =  m[8];
+        setRotation(r);
+    }
+
+    // --------------------------------------------------------------------
+
+    /** Takes a row-major 3x3 rotation in Ambisonic X/Y/Z coordinates. */
+    void setRotation(const float* r)
+    {
+        // order 1 is the rotation itself, permuted into ACN order (Y, Z, X)
+        static const uint8_t acnAxis[3] = { 1, 2, 0 };
+        float* r1 = &coefficients[0];
+        for (uint8_t row = 0; row < 3; ++row)
+        {
+            for (uint8_t col = 0; col < 3; ++col)
+            {
+                r1[row * 3 + col] = r[acnAxis[row] * 3 + acnAxis[col]];
+            }
+        }
+
+        for (int l = 2; l <= MaxOrder; ++l)
+        {
+            const float* prev = &coefficients[blockOffset(l - 1)];
+            float* block = &coefficients[blockOffset(l)];
+            const int width = 2 * l + 1;
+            for (int m = -l; m <= l; ++m)
+            {
+                const int absM = (m < 0) ? -m : m;
+                const float d = (m == 0) ? 1.0f : 0.0f;
+                for (int n = -l; n <= l; ++n)
+                {
+                    const int absN = (n < 0) ? -n : n;
+                    const float denominator = (absN < l) ?
+                        static_cast<float>((l + n) * (l - n)) :
+                        static_cast<float>((2 * l) * (2 * l - 1));
+                    const float u = sqrtf(static_cast<float>((l + m) * (l - m)) / denominator);
+                    const float v = 0.5f * sqrtf((1.0f + d) * static_cast<float>((l + absM - 1) * (l + absM)) / denominator) * (1.0f - 2.0f * d);
+                    const float w = -0.5f * sqrtf(static_cast<float>((l - absM - 1) * (l - absM)) / denominator) * (1.0f - d);
+
+                    float value = 0.0f;
+                    if (u != 0.0f) value += u * termU(r1, prev, l, m, n);
+                    if (v != 0.0f) value += v * termV(r1, prev, l, m, n);
+                    if (w != 0.0f) value += w * termW(r1, prev, l, m, n);
+                    block[(m + l) * width + (n + l)] = value;
+                }
+            }
+        }
+    }
+
+    // --------------------------------------------------------------------
+
+private:
+    // 9 + 25 + 49 + 81 + 121
+    static constexpr int NumCoefficients = 285;
+    float coefficients[NumCoefficients];
+
+    // --------------------------------------------------------------------
+
+    static constexpr int blockOffset(const int order)
+    {
+        // sum of (2k+1)^2 for k = 1 .. order-1
+        return order * (2 * order - 1) * (2 * order + 1) / 3 - 1;
+    }
+
+    // --------------------------------------------------------------------
+
+    static float at1(const float* r1, const int i, const int j)
+    {
+        return r1[(i + 1) * 3 + (j + 1)];
+    }
+
+    // --------------------------------------------------------------------
+
+    static float atPrev(const float* prev, const int l, const int i, const int j)
+    {
+        // prev is the block for order l-1
+        return prev[(i + l - 1) * (2 * l - 1) + (j + l - 1)];
+    }
+
+    // --------------------------------------------------------------------
+
+    static float termP(const float* r1, const float* prev, const int i, const int l, const int a, const int b)
+    {
+        if (b == l)
+        {
+            return at1(r1, i, 1) * atPrev(prev, l, a, l - 1) - at1(r1, i, -1) * atPrev(prev, l, a, 1 - l);
+        }
+        if (b == -l)
+        {
+            return at1(r1, i, 1) * atPrev(prev, l, a, 1 - l) + at1(r1, i, -1) * atPrev(prev, l, a, l - 1);
+        }
+        return at1(r1, i, 0) * atPrev(prev, l, a, b);
+    }
+
+    // --------------------------------------------------------------------
+
+    static float termU(const float* r1, const float* prev, const int l, const int m, const int n)
+    {
+        return termP(r1, prev, 0, l, m, n);
+    }
+
+    // --------------------------------------------------------------------
+
+    static float termV(const float* r1, const float* prev, const int l, const int m, const int n)
+    {
+        if (m == 0)
+        {
+            return termP(r1, prev, 1, l, 1, n) + termP(r1, prev, -1, l, -1, n);
+        }
+        if (m > 0)
+        {
+            const bool d = (m == 1);
+            return termP(r1, prev, 1, l, m - 1, n) * (d ? sqrtf(2.0f) : 1.0f)
+                 - (d ? 0.0f : termP(r1, prev, -1, l, 1 - m, n));
+        }
+        const bool d = (m == -1);
+        return (d ? 0.0f : termP(r1, prev, 1, l, m + 1, n))
+             + termP(r1, prev, -1, l, -m - 1, n) * (d ? sqrtf(2.0f) : 1.0f);
+    }
+
+    // --------------------------------------------------------------------
+
+    static float termW(const float* r1, const float* prev, const int l, const int m, const int n)
+    {
+        // never called when m == 0
+        if (m > 0)
+        {
+            return termP(r1, prev, 1, l, m + 1, n) + termP(r1, prev, -1, l, -m - 1, n);
+        }
+        return termP(r1, prev, 1, l, m - 1, n) - termP(r1, prev, -1, l, 1 - m, n);
+    }
+};
@@ -0,0 +1,628 @@
+/*
+ * Firmware transfer: both ends of a windowed file transfer over System Exclusive
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/** Sends a firmware image to the bootloader as a stream of System Exclusive
+    blocks. Up to windowBlocks blocks are in flight at once: the bootloader
+    acknowledges each block with the index of the next one it expects, and
+    every acknowledgement opens the window a little further, so the link is
+    kept busy without overrunning the device. A damaged or missing block is
+    reported straight away (a negative acknowledgement), and a silent link
+    is caught by a timeout; either way, sending goes back to the first block
+    not yet acknowledged. Nothing here reads a clock or starts a thread:
+    advanceTo() is called with the time, as with TrackerSimulator.
+
+    The message layout is this library's own, and FirmwareReceiver is its
+    other half. Check it against the bootloader specification on the support
+    page before sending an image to real hardware. After the manufacturer
+    ID, host messages are 0x50 then:
+        0x00 Begin: image size (5 bytes), block size (2), CRC-32 (5)
+        0x01 Block: index (2), payload (7 bytes packed into 8), checksum (1)
+        0x02 End:   number of blocks (3)
+    and bootloader replies are 0x51 then:
+        0x00 Ack index (2): every block before index has arrived
+        0x01 Nak index (2): resend from index
+        0x02 Done: the image is complete, and its CRC matches
+        0x03 Failed
+    Multi-byte numbers are sent seven bits at a time, most significant
+    first. Block indices are 14 bits, and wrap round. */
+class FirmwareTransfer
+{
+public:
+    enum class State { Idle, Starting, Sending, Finishing, Succeeded, Failed };
+
+    class Output
+    {
+    public:
+        virtual ~Output() {};
+
+        /** A complete System Exclusive message, including the 0xF0 and 0xF7.
+            The data is only valid for the duration of the call. */
+        virtual void firmwareSysex(const uint8_t* data, const size_t numBytes) = 0;
+    };
+
+    class Listener
+    {
+    public:
+        virtual ~Listener() {};
+
+        /** Called whenever more of the image has been acknowledged. */
+        virtual void firmwareProgress(size_t /*bytesAcknowledged*/, size_t /*totalBytes*/) {}
+        /** Called once, when the bootloader accepts the image or the transfer
+            gives up. */
+        virtual void firmwareFinished(bool /*isSuccessful*/) {}
+    };
+
+    /** The defaults suit a full-speed USB-MIDI link: a 224-byte block is 256
+        bytes once packed, and eight of them in flight keep the link busy
+        across the bootloader's turnaround. Larger windows only help if the
+        device has the buffer space for them. */
+    struct Settings
+    {
+        size_t blockBytes;
+        size_t windowBlocks;
+        double timeoutSeconds;
+        int maxRetries;
+
+        Settings() :
+            blockBytes(224),
+            windowBlocks(8),
+            timeoutSeconds(0.25),
+            maxRetries(8)
+        {}
+    };
+
+    // ------------------------------------------------------------------------
+
+    FirmwareTransfer(Output* output = nullptr, Listener* listener = nullptr) :
+        o(output),
+        l(listener),
+        state(State::Idle),
+        now(0.0),
+        lastProgressTime(0.0),
+        numBlocks(0),
+        base(0),
+        nextToSend(0),
+        retries(0),
+        numRetransmissions(0)
+    {}
+
+    // ------------------------------------------------------------------------
+
+    /** There can be only one output */
+    void setOutput(Output* output)
+    {
+        o = output;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** There can be only one listener */
+    void setListener(Listener* listener)
+    {
+        l = listener;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Copies the image, and sends Begin. The block size is rounded down to a
+        multiple of seven, which packs without waste. This allocates memory. */
+    void start(const uint8_t* image, const size_t numBytes, const Settings& transferSettings = Settings())
+    {
+        settings = roundSettings(transferSettings);
+        firmware.assign(image, image + numBytes);
+        numBlocks = (numBytes + settings.blockBytes - 1) / settings.blockBytes;
+        base = 0;
+        nextToSend = 0;
+        retries = 0;
+        numRetransmissions = 0;
+        state = State::Starting;
+        sendBegin();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Abandons a transfer. The bootloader is left waiting for blocks; it
+        starts again on the next Begin. */
+    void cancel()
+    {
+        if (isActive())
+        {
+            finish(false);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Moves the clock on, resending whatever has timed out. */
+    void advanceTo(const double timeSeconds)
+    {
+        now = timeSeconds;
+        if (!isActive() || (now - lastProgressTime < settings.timeoutSeconds))
+        {
+            return;
+        }
+        if (++retries > settings.maxRetries)
+        {
+            finish(false);
+            return;
+        }
+        if (state == State::Starting)
+        {
+            sendBegin();
+        }
+        else if (state == State::Finishing)
+        {
+            sendEnd();
+        }
+        else
+        {
+            goBack(base);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** A message from the bootloader, stripped of the leading 0xF0 and trailing
+        0xF7. Returns true if it belonged to the transfer. */
+    bool processSysex(const uint8_t* data, const size_t numBytes)
+    {
+        if ((numBytes < 5) || (data[0] != 0x00) || (data[1] != 0x21) || (data[2] != 0x42) || (data[3] != ReplyMessage))
+        {
+            return false;
+        }
+        if (!isActive())
+        {
+            return true;
+        }
+
+        const uint8_t reply = data[4];
+        if ((reply == ReplyDone) || (reply == ReplyFailed))
+        {
+            if (state == State::Finishing)
+            {
+                finish(reply == ReplyDone);
+            }
+            return true;
+        }
+        if (numBytes < 7)
+        {
+            return true;
+        }
+
+        const size_t index = unwrap(static_cast<size_t>((data[5] << 7) | data[6]));
+        if (reply == ReplyAck)
+        {
+            if (state == State::Starting)
+            {
+                state = State::Sending;
+                madeProgress();
+            }
+            else if ((state == State::Sending) && (index > base) && (index <= nextToSend))
+            {
+                base = index;
+                madeProgress();
+                if (l) l->firmwareProgress(getBytesAcknowledged(), firmware.size());
+            }
+        }
+        else if ((reply == ReplyNak) && (state == State::Sending) && (index >= base) && (index < nextToSend))
+        {
+            goBack(index);
+        }
+        pump();
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    State getState() const
+    {
+        return state;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isActive() const
+    {
+        return (state == State::Starting) || (state == State::Sending) || (state == State::Finishing);
+    }
+
+    // ------------------------------------------------------------------------
+
+    size_t getBytesAcknowledged() const
+    {
+        const size_t bytes = base * settings.blockBytes;
+        return (bytes < firmware.size()) ? bytes : firmware.size();
+    }
+
+    // ------------------------------------------------------------------------
+
+    float getProgress() const
+    {
+        return firmware.empty() ? 0.0f : static_cast<float>(getBytesAcknowledged()) / static_cast<float>(firmware.size());
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Settings as start() rounds them, to what the format can carry. */
+    static Settings roundSettings(Settings s)
+    {
+        s.blockBytes -= s.blockBytes % 7;
+        if (s.blockBytes < 7) s.blockBytes = 7;
+        if (s.blockBytes > MaxBlockBytes) s.blockBytes = MaxBlockBytes;
+        if (s.windowBlocks < 1) s.windowBlocks = 1;
+        if (s.windowBlocks > MaxWindowBlocks) s.windowBlocks = MaxWindowBlocks;
+        return s;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The settings in use, as rounded by start(). */
+    const Settings& getSettings() const
+    {
+        return settings;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The length of the message, 0xF0 to 0xF7, that carries a full block:
+        header, index, the block packed seven into eight, checksum. */
+    static size_t getBlockMessageBytes(const size_t blockBytes)
+    {
+        return 10 + blockBytes / 7 * 8;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Blocks sent more than once. A healthy link shows none. */
+    uint64_t getNumRetransmissions() const
+    {
+        return numRetransmissions;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** CRC-32 (as used by zip), which Begin carries and the bootloader checks. */
+    static uint32_t crc32(const uint8_t* data, const size_t numBytes)
+    {
+        uint32_t crc = 0xffffffff;
+        for (size_t i = 0; i < numBytes; ++i)
+        {
+            crc ^= data[i];
+            for (uint8_t bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+
+    // ------------------------------------------------------------------------
+
+    static constexpr uint8_t HostMessage = 0x50;
+    static constexpr uint8_t ReplyMessage = 0x51;
+    static constexpr uint8_t HostBegin = 0x00;
+    static constexpr uint8_t HostBlock = 0x01;
+    static constexpr uint8_t HostEnd = 0x02;
+    static constexpr uint8_t ReplyAck = 0x00;
+    static constexpr uint8_t ReplyNak = 0x01;
+    static constexpr uint8_t ReplyDone = 0x02;
+    static constexpr uint8_t ReplyFailed = 0x03;
+    static constexpr size_t MaxBlockBytes = 1022; // 146 groups of seven
+    static constexpr size_t MaxWindowBlocks = 64;
+    static constexpr size_t IndexMask = 0x3fff;
+
+    // ------------------------------------------------------------------------
+
+    /** Writes value as numBytes seven-bit bytes, most significant first. */
+    static void put7(uint8_t* buffer, uint64_t value, const size_t numBytes)
+    {
+        for (size_t i = numBytes; i > 0; --i)
+        {
+            buffer[i - 1] = static_cast<uint8_t>(value & 0x7f);
+            value >>= 7;
+        }
+    }
+
+    static uint64_t get7(const uint8_t* buffer, const size_t numBytes)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < numBytes; ++i)
+        {
+            value = (value << 7) | (buffer[i] & 0x7f);
+        }
+        return value;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    Output* o;
+    Listener* l;
+    Settings settings;
+    State state;
+    std::vector<uint8_t> firmware;
+    double now, lastProgressTime;
+    size_t numBlocks, base, nextToSend;
+    int retries;
+    uint64_t numRetransmissions;
+    uint8_t message[MaxBlockBytes + MaxBlockBytes / 7 + 16];
+
+    // ------------------------------------------------------------------------
+
+    void madeProgress()
+    {
+        lastProgressTime = now;
+        retries = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Turns a 14-bit index from the bootloader into a block number near
+        the window. */
+    size_t unwrap(const size_t index) const
+    {
+        const size_t offset = (index - (base & IndexMask)) & IndexMask;
+        return (offset <= IndexMask / 2) ? base + offset : base - ((IndexMask + 1) - offset);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void goBack(const size_t index)
+    {
+        numRetransmissions += nextToSend - index;
+        nextToSend = index;
+        lastProgressTime = now;
+        pump();
+    }
+
+    // ------------------------------------------------------------------------
+
+    void pump()
+    {
+        if (state != State::Sending)
+        {
+            return;
+        }
+        while ((nextToSend < numBlocks) && (nextToSend < base + settings.windowBlocks))
+        {
+            sendBlock(nextToSend++);
+        }
+        if (base == numBlocks)
+        {
+            state = State::Finishing;
+            madeProgress();
+            sendEnd();
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    size_t header(const uint8_t command)
+    {
+        message[0] = 0xf0; message[1] = 0x00; message[2] = 0x21; message[3] = 0x42;
+        message[4] = HostMessage;
+        message[5] = command;
+        return 6;
+    }
+
+    void send(size_t size)
+    {
+        message[size++] = 0xf7;
+        if (o) o->firmwareSysex(message, size);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void sendBegin()
+    {
+        size_t size = header(HostBegin);
+        put7(message + size, firmware.size(), 5); size += 5;
+        put7(message + size, settings.blockBytes, 2); size += 2;
+        put7(message + size, crc32(firmware.data(), firmware.size()), 5); size += 5;
+        lastProgressTime = now;
+        send(size);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void sendBlock(const size_t index)
+    {
+        size_t size = header(HostBlock);
+        const size_t start = size;
+        put7(message + size, index & IndexMask, 2); size += 2;
+
+        // seven bytes go out as eight: their top bits first, then the low seven bits of each
+        const size_t first = index * settings.blockBytes;
+        const size_t last = (first + settings.blockBytes < firmware.size()) ? first + settings.blockBytes : firmware.size();
+        for (size_t group = first; group < last; group += 7)
+        {
+            uint8_t& topBits = message[size++];
+            topBits = 0;
+            for (size_t i = group; (i < group + 7) && (i < last); ++i)
+            {
+                topBits |= static_cast<uint8_t>((firmware[i] >> 7) << (i - group));
+                message[size++] = firmware[i] & 0x7f;
+            }
+        }
+
+        uint8_t checksum = 0;
+        for (size_t i = start; i < size; ++i)
+        {
+            checksum ^= message[i];
+        }
+        message[size++] = checksum;
+        send(size);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void sendEnd()
+    {
+        size_t size = header(HostEnd);
+        put7(message + size, numBlocks, 3); size += 3;
+        send(size);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void finish(const bool isSuccessful)
+    {
+        state = isSuccessful ? State::Succeeded : State::Failed;
+        if (l) l->firmwareFinished(isSuccessful);
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/** The bootloader's half of FirmwareTransfer: reassembles the image, and
+    writes a reply for every message. It's used by TrackerSimulator, and
+    would be a starting point for a device that speaks this protocol. */
+class FirmwareReceiver
+{
+public:
+    FirmwareReceiver() :
+        blockBytes(0),
+        expected(0),
+        expectedCrc(0),
+        hasNaked(false),
+        isComplete(false)
+    {}
+
+    // ------------------------------------------------------------------------
+
+    /** Takes a host message, stripped of 0xF0 and 0xF7, and writes the reply,
+        with 0xF0 and 0xF7, to reply (which needs MaxReplyBytes). Returns the
+        reply's length, or 0 if there isn't one. Begin allocates memory. */
+    size_t processSysex(const uint8_t* data, const size_t numBytes, uint8_t* reply)
+    {
+        typedef FirmwareTransfer FT;
+        if ((numBytes < 5) || (data[0] != 0x00) || (data[1] != 0x21) || (data[2] != 0x42) || (data[3] != FT::HostMessage))
+        {
+            return 0;
+        }
+
+        const uint8_t command = data[4];
+        if ((command == FT::HostBegin) && (numBytes == 17))
+        {
+            image.assign(static_cast<size_t>(FT::get7(data + 5, 5)), 0);
+            blockBytes = static_cast<size_t>(FT::get7(data + 10, 2));
+            expectedCrc = static_cast<uint32_t>(FT::get7(data + 12, 5));
+            expected = 0;
+            hasNaked = false;
+            isComplete = false;
+            return (blockBytes >= 7) ? formatReply(reply, FT::ReplyAck, 0) : formatReply(reply, FT::ReplyFailed);
+        }
+        if ((command == FT::HostBlock) && (numBytes >= 8) && blockBytes)
+        {
+            return receiveBlock(data + 5, numBytes - 5, reply);
+        }
+        if ((command == FT::HostEnd) && (numBytes == 8) && blockBytes)
+        {
+            const size_t numBlocks = (image.size() + blockBytes - 1) / blockBytes;
+            isComplete = (FT::get7(data + 5, 3) == numBlocks) && (expected == numBlocks) &&
+                (FT::crc32(image.data(), image.size()) == expectedCrc);
+            return formatReply(reply, isComplete ? FT::ReplyDone : FT::ReplyFailed);
+        }
+        return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** True once End has arrived and the image checks out. */
+    bool isImageComplete() const
+    {
+        return isComplete;
+    }
+
+    // ------------------------------------------------------------------------
+
+    const std::vector<uint8_t>& getImage() const
+    {
+        return image;
+    }
+
+    // ------------------------------------------------------------------------
+
+    static constexpr size_t MaxReplyBytes = 9;
+
+    // ------------------------------------------------------------------------
+
+private:
+    std::vector<uint8_t> image;
+    size_t blockBytes, expected;
+    uint32_t expectedCrc;
+    bool hasNaked, isComplete;
+
+    // ------------------------------------------------------------------------
+
+    size_t receiveBlock(const uint8_t* block, const size_t numBytes, uint8_t* reply)
+    {
+        typedef FirmwareTransfer FT;
+        uint8_t checksum = 0;
+        for (size_t i = 0; i + 1 < numBytes; ++i)
+        {
+            checksum ^= block[i];
+        }
+
+        const size_t offset = (static_cast<size_t>(FT::get7(block, 2)) - expected) & FT::IndexMask;
+        if (offset > FT::IndexMask / 2)
+        {
+            // a resend of something we already have: say where we are
+            return formatReply(reply, FT::ReplyAck, expected);
+        }
+
+        const size_t first = expected * blockBytes;
+        const size_t length = (first + blockBytes < image.size()) ? blockBytes : image.size() - first;
+        if ((offset != 0) || (checksum != block[numBytes - 1]) || (first >= image.size()) ||
+            (numBytes != 3 + length + (length + 6) / 7))
+        {
+            // Damaged, or one went missing. Ask once; the rest of the window
+            // will be discarded until the resend arrives.
+            if (hasNaked)
+            {
+                return 0;
+            }
+            hasNaked = true;
+            return formatReply(reply, FT::ReplyNak, expected);
+        }
+
+        const uint8_t* in = block + 2;
+        for (size_t group = 0; group < length; group += 7)
+        {
+            const uint8_t topBits = *in++;
+            for (size_t i = group; (i < group + 7) && (i < length); ++i)
+            {
+                image[first + i] = static_cast<uint8_t>(*in++ | (((topBits >> (i - group)) & 1) << 7));
+            }
+        }
+        ++expected;
+        hasNaked = false;
+        return formatReply(reply, FT::ReplyAck, expected);
+    }
+
+    // ------------------------------------------------------------------------
+
+    static size_t formatReply(uint8_t* reply, const uint8_t type, const size_t index = 0)
+    {
+        reply[0] = 0xf0; reply[1] = 0x00; reply[2] = 0x21; reply[3] = 0x42;
+        reply[4] = FirmwareTransfer::ReplyMessage;
+        reply[5] = type;
+        if ((type == FirmwareTransfer::ReplyAck) || (type == FirmwareTransfer::ReplyNak))
+        {
+            FirmwareTransfer::put7(reply + 6, index & FirmwareTransfer::IndexMask, 2);
+            reply[8] = 0xf7;
+            return 9;
+        }
+        reply[6] = 0xf7;
+        return 7;
+    }
+};
@@ -0,0 +1,249 @@
+/*
+ * Frame clock: recovers a steady timeline from jittery arrival times
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+/** A second-order delay-locked loop, after Fons Adriaensen's "Using a DLL to
+    filter time". Give it the arrival time of each periodic event, and it
+    estimates the true period and when each event really happened, filtering
+    out USB polling and scheduler jitter while following slow drift.
+    Bandwidth sets the trade-off: lower is smoother, higher locks faster.
+
+    Events are counted in units: one per tracker frame, or one per sample for
+    an audio callback. If update() isn't told how many units have passed, it
+    works it out from the period, so dropped frames don't unlock the loop.
+    An error of more than MaxErrorPeriods starts it again. */
+class FrameClock
+{
+public:
+    FrameClock(const double nominalSecondsPerUnit = 0.02, const double bandwidthHz = 0.5) :
+        nominal(nominalSecondsPerUnit),
+        bandwidth(bandwidthHz)
+    {
+        reset();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Forgets everything; the next update() starts the loop again. Setting a
+        nominal period of 0 leaves it unchanged. */
+    void reset(const double nominalSecondsPerUnit = 0.0)
+    {
+        if (nominalSecondsPerUnit > 0.0)
+        {
+            nominal = nominalSecondsPerUnit;
+        }
+        secondsPerUnit = nominal;
+        lastTime = 0.0;
+        meanSquareError = 0.0;
+        numUpdates = 0;
+        numSkipped = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Takes an event's arrival time, and returns the filtered time at which
+        it happened. units is how far it is from the last event; 0 means one
+        unit, or more if the gap says that some went missing. */
+    double update(const double arrivalSeconds, uint32_t units = 0)
+    {
+        if (numUpdates++ == 0)
+        {
+            lastTime = arrivalSeconds;
+            return lastTime;
+        }
+
+        if (units == 0)
+        {
+            // late by more than half a period: count the frames that weren't sent
+            units = 1;
+            const double late = arrivalSeconds - (lastTime + secondsPerUnit);
+            if (late > 0.5 * secondsPerUnit)
+            {
+                const uint32_t missing = static_cast<uint32_t>(floor(late / secondsPerUnit + 0.5));
+                units += missing;
+                numSkipped += missing;
+            }
+        }
+
+        const double period = secondsPerUnit * units;
+        const double predicted = lastTime + period;
+        const double e = arrivalSeconds - predicted;
+        if (fabs(e) > MaxErrorPeriods * period)
+        {
+            reset();
+            return update(arrivalSeconds);
+        }
+
+        // loop coefficients for this update's interval
+        const double w = 2.0 * Pi * bandwidth * period;
+        lastTime = predicted + sqrt(2.0) * w * e;
+        secondsPerUnit += w * w * e / units;
+        meanSquareError += (e * e - meanSquareError) * ErrorSmoothing;
+        return lastTime;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The filtered time of the latest event. */
+    double getLastTime() const
+    {
+        return lastTime;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** When the next event is expected. */
+    double getNextTime() const
+    {
+        return lastTime + secondsPerUnit;
+    }
+
+    // ------------------------------------------------------------------------
+
+    double getSecondsPerUnit() const
+    {
+        return secondsPerUnit;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** RMS difference between arrival times and the filtered timeline: the
+        jitter that's being removed. */
+    double getJitterSeconds() const
+    {
+        return sqrt(meanSquareError);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Events that were missing from the sequence. */
+    uint64_t getNumSkipped() const
+    {
+        return numSkipped;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** True once the loop has had a few time constants to settle. */
+    bool isLocked() const
+    {
+        return static_cast<double>(numUpdates) * nominal * bandwidth > LockTimeConstants;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr double Pi = 3.14159265358979;
+    static constexpr double MaxErrorPeriods = 4.0;
+    static constexpr double ErrorSmoothing = 0.01;
+    static constexpr double LockTimeConstants = 2.0;
+
+    double nominal, bandwidth;
+    double secondsPerUnit, lastTime;
+    double meanSquareError;
+    uint64_t numUpdates, numSkipped;
+};
+
+// ----------------------------------------------------------------------------
+
+/** Maps times on the host's clock to positions on the audio device's sample
+    clock. The audio callback calls audioBlock() at the start of each block;
+    a FrameClock, counting in samples, recovers the device's real sample rate
+    and each block's true start. Any other thread can then call
+    hostToSample(), which reads a consistent copy of the latest estimate
+    without locking. */
+class AudioClock
+{
+public:
+    AudioClock(const double nominalSampleRate = 48000.0, const double bandwidthHz = 0.2) :
+        clock(1.0 / nominalSampleRate, bandwidthHz),
+        nextSample(0),
+        lastBlockSamples(0),
+        sequence(0),
+        blockTime(0.0),
+        blockSample(0.0),
+        secondsPerSample(0.0)
+    {}
+
+    // ------------------------------------------------------------------------
+
+    /** From the audio thread only. If the sample rate changes, call reset()
+        first. */
+    void audioBlock(const double hostSeconds, const int numSamples)
+    {
+        const double t = clock.update(hostSeconds, lastBlockSamples);
+        publish(t, static_cast<double>(nextSample), clock.getSecondsPerUnit());
+        lastBlockSamples = static_cast<uint32_t>(numSamples);
+        nextSample += numSamples;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** From the audio thread only. */
+    void reset(const double nominalSampleRate)
+    {
+        clock.reset(1.0 / nominalSampleRate);
+        lastBlockSamples = 0;
+        publish(0.0, 0.0, 0.0);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The audio sample (counted from the first audioBlock) that was playing
+        at hostSeconds, or -1 before there's an estimate. */
+    double hostToSample(const double hostSeconds) const
+    {
+        double t, s, spu;
+        uint32_t before, after;
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            t = blockTime.load(std::memory_order_relaxed);
+            s = blockSample.load(std::memory_order_relaxed);
+            spu = secondsPerSample.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before != after) || (before & 1));
+        return (spu > 0.0) ? s + (hostSeconds - t) / spu : -1.0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** From the audio thread: the first sample of the block now being
+        processed, on the same count as hostToSample. */
+    int64_t getBlockStartSample() const
+    {
+        return nextSample - static_cast<int64_t>(lastBlockSamples);
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    FrameClock clock;
+    int64_t nextSample;
+    uint32_t lastBlockSamples;
+    std::atomic<uint32_t> sequence;
+    std::atomic<double> blockTime, blockSample, secondsPerSample;
+
+    // ------------------------------------------------------------------------
+
+    void publish(const double t, const double s, const double spu)
+    {
+        // a sequence lock: readers retry if the count was odd, or changed
+        const uint32_t n = sequence.load(std::memory_order_relaxed);
+        sequence.store(n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        blockTime.store(t, std::memory_order_relaxed);
+        blockSample.store(s, std::memory_order_relaxed);
+        secondsPerSample.store(spu, std::memory_order_relaxed);
+        sequence.store(n + 2, std::memory_order_release);
+    }
+};
@@ -0,0 +1,249 @@
+/*
+ * Gaze targets: finds which of many room-based directions the listener is facing
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class GazeTargets
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {};
+
+        /** Called from update() when a target comes inside the gaze cone. */
+        virtual void gazeTargetEntered(int /*targetIndex*/) {}
+        /** Called from update() when a target leaves the gaze cone. */
+        virtual void gazeTargetExited(int /*targetIndex*/) {}
+    };
+
+    // ------------------------------------------------------------------------
+
+    GazeTargets(Listener* listener = nullptr) :
+        l(listener),
+        cosCone(cosf(DefaultConeRadian)),
+        cosSkip(cosf(DefaultSkipRadian)),
+        bestTarget(-1),
+        bestCosine(-1.0f),
+        targetsChanged(true)
+    {
+        lastForward[0] = lastForward[1] = lastForward[2] = 0.0f;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** There can be only one listener */
+    void setListener(Listener* listener)
+    {
+        l = listener;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Preallocates storage, so that adding up to this many targets won't
+        allocate memory. */
+    void reserve(const size_t numTargets)
+    {
+        tx.reserve(numTargets);
+        ty.reserve(numTargets);
+        tz.reserve(numTargets);
+        cosines.reserve(numTargets);
+        inCone.reserve(numTargets);
+        hits.reserve(numTargets);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Registers a direction in room coordinates, and returns its index.
+        The vector doesn't need to be normalised. */
+    int addTarget(float x, float y, float z)
+    {
+        tx.push_back(0.0f);
+        ty.push_back(0.0f);
+        tz.push_back(0.0f);
+        cosines.push_back(-1.0f);
+        inCone.push_back(0);
+        if (hits.capacity() < tx.size())
+        {
+            // so that update() never allocates: it can't find more hits than targets
+            hits.reserve(tx.capacity());
+        }
+        const int index = static_cast<int>(tx.size()) - 1;
+        moveTarget(index, x, y, z);
+        return index;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Changes the direction of a target that has already been added. */
+    void moveTarget(int index, float x, float y, float z)
+    {
+        float length = sqrtf(x * x + y * y + z * z);
+        float scale = (length > 0.0f) ? 1.0f / length : 0.0f;
+        tx[index] = x * scale;
+        ty[index] = y * scale;
+        tz[index] = z * scale;
+        targetsChanged = true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Removes every target without notifying the listener. */
+    void clear()
+    {
+        tx.clear();
+        ty.clear();
+        tz.clear();
+        cosines.clear();
+        inCone.clear();
+        hits.clear();
+        bestTarget = -1;
+        bestCosine = -1.0f;
+        targetsChanged = true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    size_t getNumTargets() const
+    {
+        return tx.size();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Half-angle of the gaze cone. Targets less than this angle away from
+        the direction the listener is facing are in the cone. */
+    void setConeAngle(const float coneRadian)
+    {
+        cosCone = cosf(coneRadian);
+        targetsChanged = true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** If the gaze has moved by less than this angle since the last full query,
+        update() returns immediately and the previous results stand. Zero
+        recalculates on every call, even if the gaze hasn't moved at all. */
+    void setSkipAngle(const float skipRadian)
+    {
+        // no cosine reaches 2, so nothing is skipped
+        cosSkip = (skipRadian > 0.0f) ? cosf(skipRadian) : 2.0f;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Tests every target against the current gaze direction, and calls the
+        listener for any that have entered or left the cone. Returns false
+        if the gaze has barely moved, and nothing was recalculated. */
+    bool update(const HeadMatrix& headMatrix)
+    {
+        // the forward row of the rotation matrix
+        const float* mat = headMatrix.getMatrix();
+        const float fx = mat[3];
+        const float fy = mat[4];
+        const float fz = mat[5];
+
+        if (!targetsChanged &&
+            (fx * lastForward[0] + fy * lastForward[1] + fz * lastForward[2] >= cosSkip))
+        {
+            return false;
+        }
+        lastForward[0] = fx;
+        lastForward[1] = fy;
+        lastForward[2] = fz;
+        targetsChanged = false;
+
+        // the target arrays are kept separate so that this loop vectorises
+        const size_t numTargets = tx.size();
+        const float* x = tx.data();
+        const float* y = ty.data();
+        const float* z = tz.data();
+        float* c = cosines.data();
+        for (size_t i = 0; i < numTargets; ++i)
+        {
+            c[i] = fx * x[i] + fy * y[i] + fz * z[i];
+        }
+
+        hits.clear();
+        bestTarget = -1;
+        bestCosine = -1.0f;
+        for (size_t i = 0; i < numTargets; ++i)
+        {
+            const int index = static_cast<int>(i);
+            const bool isHit = c[i] >= cosCone;
+            if (isHit)
+            {
+                hits.push_back(index);
+                if (c[i] > bestCosine)
+                {
+                    bestCosine = c[i];
+                    bestTarget = index;
+                }
+            }
+            if (isHit != (inCone[i] != 0))
+            {
+                inCone[i] = isHit ? 1 : 0;
+                if (l)
+                {
+                    if (isHit) l->gazeTargetEntered(index);
+                    else l->gazeTargetExited(index);
+                }
+            }
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The target nearest the centre of the gaze cone, or -1 if the cone is empty. */
+    int getBestTarget() const
+    {
+        return bestTarget;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Cosine of the angle between the gaze and the best target. */
+    float getBestCosine() const
+    {
+        return bestCosine;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Indices of every target in the cone, in ascending order. */
+    const std::vector<int>& getTargetsInCone() const
+    {
+        return hits;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isInCone(const int index) const
+    {
+        return inCone[index] != 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr float DefaultConeRadian = 0.26f; // about 15 degrees
+    static constexpr float DefaultSkipRadian = 0.005f;
+
+    Listener* l;
+    std::vector<float> tx, ty, tz, cosines;
+    std::vector<uint8_t> inCone;
+    std::vector<int> hits;
+    float lastForward[3];
+    float cosCone, cosSkip;
+    int bestTarget;
+    float bestCosine;
+    bool targetsChanged;
+};
@@ -0,0 +1,125 @@
+/*
+ * Interaural parameters: ear cosines, ITD and ILD for many directions at once
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/** A batch version of HeadMatrix::getEarVectors, for any number of room-based
+    directions (direct sound, image sources, and so on), that also estimates
+    the interaural time and level differences from a spherical head model.
+    It neither allocates nor locks, so it can be called from the audio thread,
+    and its loop is free of branches and library calls so that the compiler
+    can vectorise it. */
+class Interaural
+{
+public:
+    Interaural() :
+        sampleRate(48000.0f),
+        headRadius(0.0875f),
+        maxIldDecibels(10.0f)
+    {}
+
+    // ------------------------------------------------------------------------
+
+    void setSampleRate(const float newSampleRate)
+    {
+        sampleRate = newSampleRate;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Head radius in metres: 8.75cm is the usual average adult. */
+    void setHeadRadius(const float radiusMetres)
+    {
+        headRadius = radiusMetres;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Level difference for a source directly to one side. */
+    void setMaximumIld(const float decibels)
+    {
+        maxIldDecibels = decibels;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Takes numDirections unit vectors in room coordinates, as separate x, y
+        and z arrays, and fills each output array with numDirections values:
+        - leftCosine, rightCosine: cosines of the angles to the left- and
+          right-ear poles, exactly as getEarVectors() returns for [0,-1,0];
+        - itdSamples: Woodworth's interaural time difference. Positive values
+          mean the sound reaches the right ear first;
+        - ildDecibels: a broadband level difference proportional to the sine of
+          the lateral angle. Positive values mean the right ear is louder. */
+    void process(const HeadMatrix& headMatrix,
+        const float* x, const float* y, const float* z, const size_t numDirections,
+        float* leftCosine, float* rightCosine, float* itdSamples, float* ildDecibels) const
+    {
+        // right-ear pole, as used by getEarVectors()
+        const float* mat = headMatrix.getMatrix();
+        const float ex = mat[0];
+        const float ey = mat[1];
+        const float ez = mat[2];
+        const float itdScale = sampleRate * headRadius / SpeedOfSound;
+        const float ildScale = maxIldDecibels;
+
+        // Two passes keep the number of arrays per loop small enough for the
+        // compiler's runtime aliasing checks, so both loops vectorise.
+        for (size_t i = 0; i < numDirections; ++i)
+        {
+            rightCosine[i] = ex * x[i] + ey * y[i] + ez * z[i];
+        }
+
+        for (size_t i = 0; i < numDirections; ++i)
+        {
+            const float s = rightCosine[i];
+            leftCosine[i] = -s;
+
+            // lateral angle theta = asin(s), from Abramowitz and Stegun 4.4.45;
+            // a = min(|s|, 1) is written out arithmetically to avoid a branch
+            const float absS = fabsf(s);
+            const float a = 0.5f * (absS + 1.0f - fabsf(absS - 1.0f));
+            const float polynomial = 1.5707288f + a * (-0.2121144f + a * (0.0742610f + a * -0.0187293f));
+            const float theta = copysignf(HalfPi - squareRoot(1.0f - a) * polynomial, s);
+
+            itdSamples[i] = itdScale * (theta + s);
+            ildDecibels[i] = ildScale * s;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr float SpeedOfSound = 343.0f;
+    static constexpr float HalfPi = 1.57079633f;
+
+    float sampleRate;
+    float headRadius;
+    float maxIldDecibels;
+
+    // ------------------------------------------------------------------------
+
+    /** sqrtf() can set errno, which stops loops that call it from vectorising
+        unless the compiler is told otherwise. This is the usual bit-trick
+        reciprocal square root plus two Newton steps: accurate to about 5e-6
+        for 0 <= q <= 1. */
+    static float squareRoot(const float q) noexcept
+    {
+        uint32_t bits;
+        memcpy(&bits, &q, sizeof(bits));
+        bits = 0x5f3759df - (bits >> 1);
+        float r;
+        memcpy(&r, &bits, sizeof(r));
+        r *= 1.5f - 0.5f * q * r * r;
+        r *= 1.5f - 0.5f * q * r * r;
+        return q * r;
+    }
+};
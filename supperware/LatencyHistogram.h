@@ -0,0 +1,171 @@
+/*
+ * Latency histogram: log-linear buckets that can be filled from any thread
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/** Counts durations in microseconds, in the style of an HDR histogram: the
+    first 32 buckets are a microsecond wide, and above that every doubling of
+    the range is split into 16 buckets, so the resolution is always better
+    than about 6%. Durations up to about two minutes are kept; longer ones are
+    counted in the top bucket.
+
+    record() is wait-free, so it can be called from a MIDI or audio thread
+    while another thread reads percentiles. A reading taken during a burst of
+    records may be a sample or two out of date, which doesn't matter here. */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Not safe to call while another thread is recording. */
+    void reset()
+    {
+        for (std::atomic<uint32_t>& b : buckets)
+        {
+            b.store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        maximum.store(0, std::memory_order_relaxed);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void record(const uint64_t microseconds)
+    {
+        buckets[bucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(microseconds, std::memory_order_relaxed);
+        uint64_t previous = maximum.load(std::memory_order_relaxed);
+        while ((microseconds > previous) &&
+            !maximum.compare_exchange_weak(previous, microseconds, std::memory_order_relaxed))
+        {}
+    }
+
+    // ------------------------------------------------------------------------
+
+    uint64_t getCount() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // ------------------------------------------------------------------------
+
+    uint64_t getMaximum() const
+    {
+        return maximum.load(std::memory_order_relaxed);
+    }
+
+    // ------------------------------------------------------------------------
+
+    double getMean() const
+    {
+        const uint64_t n = getCount();
+        return n ? static_cast<double>(total.load(std::memory_order_relaxed)) / static_cast<double>(n) : 0.0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Returns the duration that percent of the samples didn't exceed (to
+        within a bucket), or 0 if there are none. 100 gives the maximum. */
+    uint64_t getPercentile(const double percent) const
+    {
+        uint64_t n = 0;
+        for (const std::atomic<uint32_t>& b : buckets)
+        {
+            n += b.load(std::memory_order_relaxed);
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (percent >= 100.0)
+        {
+            return getMaximum();
+        }
+
+        const double wanted = (percent <= 0.0) ? 1.0 : percent * 0.01 * static_cast<double>(n);
+        uint64_t seen = 0;
+        for (int i = 0; i < NumBuckets; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (static_cast<double>(seen) >= wanted)
+            {
+                // the top of the bucket, so that the answer is never optimistic
+                const uint64_t top = bucketLowest(i + 1) - 1;
+                const uint64_t m = getMaximum();
+                return (top < m) ? top : m;
+            }
+        }
+        return getMaximum();
+    }
+
+    // ------------------------------------------------------------------------
+
+    static constexpr int getNumBuckets()
+    {
+        return NumBuckets;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** For drawing the distribution: a bucket's count, and the smallest
+        duration it holds. */
+    uint32_t getBucketCount(const int index) const
+    {
+        return buckets[index].load(std::memory_order_relaxed);
+    }
+
+    static uint64_t bucketLowest(const int index)
+    {
+        if (index < 2 * SubBuckets)
+        {
+            return static_cast<uint64_t>(index);
+        }
+        const int shift = index / SubBuckets - 1;
+        return static_cast<uint64_t>(SubBuckets + index % SubBuckets) << shift;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr int SubBucketBits = 4;
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    static constexpr int HighestBit = 26; // 2^27 microseconds is a little over two minutes
+    static constexpr int NumBuckets = (HighestBit - SubBucketBits + 2) * SubBuckets;
+
+    std::atomic<uint32_t> buckets[NumBuckets];
+    std::atomic<uint64_t> count, total, maximum;
+
+    // ------------------------------------------------------------------------
+
+    static int bucketIndex(const uint64_t value)
+    {
+        if (value < 2 * SubBuckets)
+        {
+            return static_cast<int>(value);
+        }
+        int bit = SubBucketBits + 1;
+        while ((bit < 63) && (value >> (bit + 1)))
+        {
+            ++bit;
+        }
+        if (bit > HighestBit)
+        {
+            return NumBuckets - 1;
+        }
+        const int shift = bit - SubBucketBits;
+        return (shift + 1) * SubBuckets + static_cast<int>((value >> shift) - SubBuckets);
+    }
+};
@@ -0,0 +1,185 @@
+/*
+ * Motion rate: chooses the head tracker's frame rate from how fast the head is turning
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+/** Watches the angular speed of the head from one frame to the next, and
+    decides whether the tracker should run at 100Hz (for low latency while the
+    head is turning quickly) or 50Hz (to halve the USB and host load while
+    it's still). Two thresholds and a hold time stop it from switching back
+    and forth: it goes fast as soon as the speed passes the upper threshold,
+    and slow only when the speed has stayed under the lower one for the hold
+    time.
+
+    The speed is the angle of the rotation between consecutive frames, over
+    the time between them, so it includes roll and isn't thrown by gimbal
+    lock. It rises immediately and decays with a short time constant.
+
+    update() should be called from one thread. The statistics can be read
+    from any thread. */
+class MotionRate
+{
+public:
+    MotionRate(const float fastDegreesPerSecond = 60.0f, const float slowDegreesPerSecond = 20.0f,
+        const double holdSeconds = 1.0) :
+        fastThreshold(fastDegreesPerSecond * DegreesToRadians),
+        slowThreshold(slowDegreesPerSecond * DegreesToRadians),
+        hold(holdSeconds),
+        isFast(false)
+    {
+        reset(false);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Forgets the motion, and the statistics; starts at the given rate. */
+    void reset(const bool startFast)
+    {
+        isFast = startFast;
+        hasLast = false;
+        speed = 0.0f;
+        lastTime = 0.0;
+        slowSince = 0.0;
+        secondsFast = 0.0;
+        secondsSlow = 0.0;
+        numSwitches = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Takes each frame's orientation, and its time in seconds (a smoothed
+        time, such as FrameClock's, gives the steadiest speed). Returns true
+        if the tracker should be at 100Hz. */
+    bool update(const HeadMatrix& headMatrix, const double seconds)
+    {
+        float columns[9];
+        for (int i = 0; i < 3; ++i)
+        {
+            columns[3 * i] = (i == 0) ? 1.0f : 0.0f;
+            columns[3 * i + 1] = (i == 1) ? 1.0f : 0.0f;
+            columns[3 * i + 2] = (i == 2) ? 1.0f : 0.0f;
+            headMatrix.transform(columns[3 * i], columns[3 * i + 1], columns[3 * i + 2]);
+        }
+
+        const double dt = seconds - lastTime;
+        if (hasLast && (dt > 0.0) && (dt < MaxGapSeconds))
+        {
+            const float instant = rotationAngle(last, columns) / static_cast<float>(dt);
+            const float decay = static_cast<float>(dt / DecaySeconds);
+            speed = (instant > speed) ? instant : speed + (instant - speed) * ((decay < 1.0f) ? decay : 1.0f);
+            std::atomic<double>& counter = isFast ? secondsFast : secondsSlow;
+            counter.store(counter.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+            decide(seconds);
+        }
+        else
+        {
+            slowSince = seconds;
+        }
+
+        for (int i = 0; i < 9; ++i)
+        {
+            last[i] = columns[i];
+        }
+        lastTime = seconds;
+        hasLast = true;
+        return isFast;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isFastRate() const
+    {
+        return isFast;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The smoothed angular speed, in degrees per second. */
+    float getDegreesPerSecond() const
+    {
+        return speed / DegreesToRadians;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Time spent at each rate since the last reset, counted between frames
+        (gaps in the stream aren't counted). */
+    double getSecondsAt100Hz() const
+    {
+        return secondsFast;
+    }
+
+    double getSecondsAt50Hz() const
+    {
+        return secondsSlow;
+    }
+
+    // ------------------------------------------------------------------------
+
+    uint32_t getNumSwitches() const
+    {
+        return numSwitches;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr float DegreesToRadians = 3.14159265f / 180.0f;
+    static constexpr double DecaySeconds = 0.1;
+    static constexpr double MaxGapSeconds = 0.25;
+
+    float fastThreshold, slowThreshold;
+    double hold;
+    std::atomic<bool> isFast;
+    bool hasLast;
+    float last[9];
+    std::atomic<float> speed;
+    double lastTime, slowSince;
+    std::atomic<double> secondsFast, secondsSlow;
+    std::atomic<uint32_t> numSwitches;
+
+    // ------------------------------------------------------------------------
+
+    void decide(const double seconds)
+    {
+        if (speed >= slowThreshold)
+        {
+            slowSince = seconds;
+        }
+        if (!isFast && (speed > fastThreshold))
+        {
+            isFast = true;
+            ++numSwitches;
+        }
+        else if (isFast && (seconds - slowSince >= hold))
+        {
+            isFast = false;
+            ++numSwitches;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** The angle of the rotation from a to b, each given as the images of the
+        three axes. The sine comes from the skew-symmetric part of aT.b, which
+        keeps small angles accurate in single precision. */
+    static float rotationAngle(const float* a, const float* b)
+    {
+        auto dot = [a, b](const int i, const int j)
+        {
+            return a[3 * i] * b[3 * j] + a[3 * i + 1] * b[3 * j + 1] + a[3 * i + 2] * b[3 * j + 2];
+        };
+        const float c = 0.5f * (dot(0, 0) + dot(1, 1) + dot(2, 2) - 1.0f);
+        const float sx = dot(2, 1) - dot(1, 2);
+        const float sy = dot(0, 2) - dot(2, 0);
+        const float sz = dot(1, 0) - dot(0, 1);
+        return atan2f(0.5f * sqrtf(sx * sx + sy * sy + sz * sz), c);
+    }
+};
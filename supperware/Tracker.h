@@ -59,6 +59,9 @@ public:
 
         /** Called when the gyroscope calibration has finished */
         virtual void trackerGyroCalibrated() {}
+
+        /** Called when the reply to a probeMessage arrives */
+        virtual void trackerProbeReceived() {}
     };
 
     // ------------------------------------------------------------------------
@@ -202,6 +205,20 @@ public:
 
     // ------------------------------------------------------------------------
 
+    /** Format a System Exclusive probe: a readback of the sensor setup
+        register, which changes nothing, and whose reply is reported to the
+        listener as trackerProbeReceived(). Time the round trip with it. */
+    size_t probeMessage(uint8_t* buffer) const
+    {
+        constexpr int MessageLength = 7;
+        supperwareSysex(buffer, MessageLength);
+        buffer[4] = 0x02; // Message 2 : Readback
+        buffer[5] = 0x00; // -- Sensor setup
+        return MessageLength;
+    }
+
+    // ------------------------------------------------------------------------
+
     /** The buffer passed to this call and the byte count should be stripped of
         the leading 0xF0 and trailing 0xF7. Returns true if we have handled the 
         message.
@@ -320,7 +337,12 @@ private:
 
     void processReadback(const uint8_t parameter, const uint8_t value)
     {
-        if (parameter == 0x03)
+        if (parameter == 0x00)
+        {
+            // nothing else asks for this one
+            if (l) l->trackerProbeReceived();
+        }
+        else if (parameter == 0x03)
         {
             // compass control
             state.compassOn = (value & 0x10) == 0x10;
@@ -0,0 +1,583 @@
+/*
+ * Head tracker simulator: the head tracker's side of the MIDI protocol
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/** Behaves like a head tracker at the other end of a MIDI cable, so that the
+    driver can be exercised without hardware. Commands from the host go in
+    through receiveSysex(); replies and orientation frames come out through
+    the Output, from advanceTo(). Nothing here reads a clock, so a test can
+    drive the simulator as quickly or as slowly as it likes.
+
+    It understands turning on and off, output format and rate, zeroing,
+    chirality, travel mode, compass control and calibration, and readback.
+    Readback addresses are (message << 4) | parameter, so travel mode
+    (message 1, parameter 1) reads back as 0x11. Head motion is either a
+    sinusoid on each axis, or a recording of yaw, pitch and roll, looped.
+
+    In bootloader mode it takes firmware instead, through a FirmwareReceiver,
+    over a link of limited speed (see setLinkRate), so that a transfer can be
+    timed without hardware. */
+class TrackerSimulator
+{
+public:
+    class Output
+    {
+    public:
+        virtual ~Output() {};
+
+        /** A complete System Exclusive message, including the 0xF0 and 0xF7.
+            The data is only valid for the duration of the call. */
+        virtual void simulatorSysex(const uint8_t* data, const size_t numBytes) = 0;
+    };
+
+    // ------------------------------------------------------------------------
+
+    TrackerSimulator(Output* output = nullptr) :
+        o(output),
+        now(0.0),
+        nextFrameTime(0.0),
+        calibrationEndTime(-1.0),
+        recordingRate(50.0f),
+        zeroYaw(0.0f),
+        numPendingBytes(0),
+        numFramesSent(0),
+        isBootloader(false),
+        linkBytesPerSecond(0.0),
+        linkFreeTime(0.0),
+        dropInterval(0),
+        numBlocksReceived(0),
+        firstReply(0),
+        numReplies(0)
+    {
+        memset(registers, 0, sizeof(registers));
+        registers[RegisterSensorSetup] = 0x40;
+        registers[RegisterOutputFormat] = 0x01;
+        registers[RegisterCompass] = 0x68;
+        registers[RegisterChirality] = 0x02;
+        registers[RegisterTravel] = 0x04;
+        setSyntheticMotion(1.0f, 0.2f, 0.3f, 0.35f, 0.1f, 0.5f);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** There can be only one output */
+    void setOutput(Output* output)
+    {
+        o = output;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Moves the head sinusoidally on each axis, with amplitudes in radians
+        and frequencies in Hz. */
+    void setSyntheticMotion(float yawAmplitude, float yawHz, float pitchAmplitude, float pitchHz,
+        float rollAmplitude, float rollHz)
+    {
+        recording.clear();
+        amplitude[0] = yawAmplitude;
+        amplitude[1] = pitchAmplitude;
+        amplitude[2] = rollAmplitude;
+        frequency[0] = yawHz;
+        frequency[1] = pitchHz;
+        frequency[2] = rollHz;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Plays back numFrames yaw/pitch/roll triplets, in radians, recorded at
+        frameRate; the recording loops. This allocates memory. */
+    void setRecordedMotion(const float* ypr, const size_t numFrames, const float frameRate)
+    {
+        recording.assign(ypr, ypr + 3 * numFrames);
+        recordingRate = frameRate;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Switches between behaving as the head tracker and as its bootloader,
+        which sends no frames and only understands firmware transfers. */
+    void setBootloaderMode(const bool isBootloaderMode)
+    {
+        isBootloader = isBootloaderMode;
+        numReplies = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isBootloaderMode() const
+    {
+        return isBootloader;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** In bootloader mode, each message from the host takes numBytes divided
+        by bytesPerSecond to arrive, one after another, and is answered
+        BootloaderTurnaroundSeconds after that. 0 makes the link instant. */
+    void setLinkRate(const double bytesPerSecond)
+    {
+        linkBytesPerSecond = bytesPerSecond;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** In bootloader mode, damages every interval'th firmware block (0 for
+        none), to exercise retransmission. */
+    void setBootloaderDropInterval(const int interval)
+    {
+        dropInterval = interval;
+    }
+
+    // ------------------------------------------------------------------------
+
+    const FirmwareReceiver& getFirmwareReceiver() const
+    {
+        return firmwareReceiver;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** A message from the host, stripped of the leading 0xF0 and trailing 0xF7
+        as with juce::MidiMessage::getSysExData. Replies are sent on the next
+        call to advanceTo(), as a real head tracker doesn't answer instantly. */
+    void receiveSysex(const uint8_t* data, const size_t numBytes)
+    {
+        if ((numBytes < 4) || (data[0] != 0x00) || (data[1] != 0x21) || (data[2] != 0x42))
+        {
+            return;
+        }
+        if (isBootloader)
+        {
+            receiveBootloaderSysex(data, numBytes);
+            return;
+        }
+
+        const uint8_t message = data[3];
+        if (message < 2)
+        {
+            for (size_t i = 4; i + 1 < numBytes; i += 2)
+            {
+                writeRegister(static_cast<uint8_t>((message << 4) | (data[i] & 0x0f)), data[i + 1]);
+            }
+        }
+        else if (message == 2)
+        {
+            uint8_t reply[MaxMessageBytes];
+            size_t size = 5;
+            reply[0] = 0xf0; reply[1] = 0x00; reply[2] = 0x21; reply[3] = 0x42; reply[4] = 0x42;
+            for (size_t i = 4; (i < numBytes) && (size + 3 <= MaxMessageBytes); ++i)
+            {
+                reply[size++] = data[i];
+                reply[size++] = readRegister(data[i]);
+            }
+            reply[size++] = 0xf7;
+            queueMessage(reply, size);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Moves the simulated clock on to timeSeconds, sending any replies that are
+        waiting, and a frame if one is due. Call this at least as often as the
+        frame rate: like the real head tracker, the simulator drops frames
+        rather than sending a burst after a stall. */
+    void advanceTo(const double timeSeconds)
+    {
+        now = timeSeconds;
+        if ((calibrationEndTime >= 0.0) && (now >= calibrationEndTime))
+        {
+            calibrationEndTime = -1.0;
+            queueStatus(StatusCalibrationSucceeded);
+            if (isCompassOn())
+            {
+                queueStatus(StatusGoodData);
+            }
+        }
+        flushPending();
+        while (numReplies && (replies[firstReply].time <= now))
+        {
+            if (o) o->simulatorSysex(replies[firstReply].bytes, replies[firstReply].numBytes);
+            firstReply = (firstReply + 1) % MaxReplies;
+            --numReplies;
+        }
+
+        if (!isBootloader && isStreaming() && (now >= nextFrameTime))
+        {
+            const double period = getFramePeriod();
+            if (now - nextFrameTime >= period)
+            {
+                nextFrameTime = now;
+            }
+            sendFrame(nextFrameTime);
+            nextFrameTime += period;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** How long advanceTo() can wait before it has something to do. */
+    double getSecondsToNextEvent() const
+    {
+        double wait = IdleSeconds;
+        if (numPendingBytes)
+        {
+            return 0.0;
+        }
+        if (numReplies && (replies[firstReply].time - now < wait))
+        {
+            wait = replies[firstReply].time - now;
+        }
+        if (!isBootloader && isStreaming() && (nextFrameTime - now < wait))
+        {
+            wait = nextFrameTime - now;
+        }
+        if ((calibrationEndTime >= 0.0) && (calibrationEndTime - now < wait))
+        {
+            wait = calibrationEndTime - now;
+        }
+        return (wait > 0.0) ? wait : 0.0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isStreaming() const
+    {
+        return (registers[RegisterSensorSetup] & 0x08) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool is100Hz() const
+    {
+        return (registers[RegisterSensorSetup] & 0x20) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isCompassOn() const
+    {
+        return (registers[RegisterCompass] & 0x10) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    uint64_t getNumFramesSent() const
+    {
+        return numFramesSent;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Converts a number to the head tracker's Q2.11 format: the inverse of
+        Tracker's bytes211ToFloat. */
+    static void floatToBytes211(const float f, uint8_t* buffer) noexcept
+    {
+        int w = static_cast<int>(lrintf(f * 2048.0f));
+        if (w > 0x1fff) w = 0x1fff;
+        if (w < -0x2000) w = -0x2000;
+        if (w < 0) w += 0x4000;
+        buffer[0] = static_cast<uint8_t>(w >> 7);
+        buffer[1] = static_cast<uint8_t>(w & 0x7f);
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr uint8_t RegisterSensorSetup = 0x00;
+    static constexpr uint8_t RegisterOutputFormat = 0x01;
+    static constexpr uint8_t RegisterCompass = 0x03;
+    static constexpr uint8_t RegisterChirality = 0x04;
+    static constexpr uint8_t RegisterZero = 0x10;
+    static constexpr uint8_t RegisterTravel = 0x11;
+    static constexpr uint8_t RegisterStatus = 0x05;
+    static constexpr uint8_t NumRegisters = 32;
+
+    static constexpr uint8_t StatusCalibrating = 1;
+    static constexpr uint8_t StatusCalibrationSucceeded = 2;
+    static constexpr uint8_t StatusGoodData = 5;
+
+    static constexpr size_t MaxMessageBytes = 64;
+    static constexpr size_t MaxPendingBytes = 512;
+    static constexpr size_t MaxReplies = 128;
+    static constexpr double BootloaderTurnaroundSeconds = 0.001;
+    static constexpr double CalibrationSeconds = 2.0;
+    static constexpr double IdleSeconds = 0.1;
+    static constexpr float Pi = 3.14159265f;
+
+    Output* o;
+    HeadMatrix headMatrix;
+    uint8_t registers[NumRegisters];
+    double now, nextFrameTime, calibrationEndTime;
+    float amplitude[3], frequency[3];
+    std::vector<float> recording;
+    float recordingRate;
+    float zeroYaw;
+    uint8_t pending[MaxPendingBytes];
+    size_t numPendingBytes;
+    uint64_t numFramesSent;
+
+    struct TimedReply
+    {
+        double time;
+        uint8_t bytes[FirmwareReceiver::MaxReplyBytes];
+        size_t numBytes;
+    };
+
+    bool isBootloader;
+    FirmwareReceiver firmwareReceiver;
+    double linkBytesPerSecond, linkFreeTime;
+    int dropInterval;
+    uint64_t numBlocksReceived;
+    TimedReply replies[MaxReplies];
+    size_t firstReply, numReplies;
+
+    // ------------------------------------------------------------------------
+
+    double getFramePeriod() const
+    {
+        return is100Hz() ? 0.01 : 0.02;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void writeRegister(const uint8_t address, const uint8_t value)
+    {
+        if (address >= NumRegisters)
+        {
+            return;
+        }
+
+        if (address == RegisterZero)
+        {
+            // a command rather than a setting
+            if (value & 0x01)
+            {
+                float ypr[3];
+                getMotion(now, ypr);
+                zeroYaw = ypr[0];
+            }
+        }
+        else if (address == RegisterCompass)
+        {
+            // 0x20 applies the on/off and correction bits; 0x04 starts calibration
+            if (value & 0x20)
+            {
+                registers[RegisterCompass] = static_cast<uint8_t>((registers[RegisterCompass] & ~0x18) | (value & 0x18));
+            }
+            if (value & 0x04)
+            {
+                calibrationEndTime = now + CalibrationSeconds;
+                queueStatus(StatusCalibrating);
+            }
+        }
+        else
+        {
+            if ((address == RegisterSensorSetup) && !isStreaming() && (value & 0x08))
+            {
+                nextFrameTime = now;
+            }
+            registers[address] = value;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    uint8_t readRegister(const uint8_t address) const
+    {
+        if (address >= NumRegisters)
+        {
+            return 0;
+        }
+        if (address == RegisterCompass)
+        {
+            // the bottom two bits report the compass's state
+            uint8_t state = 0;
+            if (calibrationEndTime >= 0.0) state = 3;
+            else if (isCompassOn()) state = 2;
+            return static_cast<uint8_t>((registers[RegisterCompass] & 0x7c) | state);
+        }
+        return registers[address];
+    }
+
+    // ------------------------------------------------------------------------
+
+    void receiveBootloaderSysex(const uint8_t* data, const size_t numBytes)
+    {
+        // the message occupies the link (plus the 0xF0 and 0xF7) before the bootloader sees it
+        double arrival = (linkFreeTime > now) ? linkFreeTime : now;
+        if (linkBytesPerSecond > 0.0)
+        {
+            arrival += static_cast<double>(numBytes + 2) / linkBytesPerSecond;
+        }
+        linkFreeTime = arrival;
+
+        const bool isBlock = (numBytes > 4) && (data[3] == FirmwareTransfer::HostMessage) && (data[4] == FirmwareTransfer::HostBlock);
+        if (isBlock && (dropInterval > 0) && ((++numBlocksReceived % static_cast<uint64_t>(dropInterval)) == 0))
+        {
+            return;
+        }
+
+        uint8_t reply[FirmwareReceiver::MaxReplyBytes];
+        const size_t replyBytes = firmwareReceiver.processSysex(data, numBytes, reply);
+        if (replyBytes && (numReplies < MaxReplies))
+        {
+            TimedReply& r = replies[(firstReply + numReplies) % MaxReplies];
+            memcpy(r.bytes, reply, replyBytes);
+            r.numBytes = replyBytes;
+            r.time = arrival + BootloaderTurnaroundSeconds;
+            ++numReplies;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    void queueStatus(const uint8_t status)
+    {
+        const uint8_t message[8] = { 0xf0, 0x00, 0x21, 0x42, 0x42, RegisterStatus, status, 0xf7 };
+        queueMessage(message, sizeof(message));
+    }
+
+    // ------------------------------------------------------------------------
+
+    void queueMessage(const uint8_t* message, const size_t numBytes)
+    {
+        // if the host floods the simulator with requests, some go unanswered
+        if (numPendingBytes + numBytes <= MaxPendingBytes)
+        {
+            memcpy(pending + numPendingBytes, message, numBytes);
+            numPendingBytes += numBytes;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    void flushPending()
+    {
+        size_t start = 0;
+        for (size_t i = 0; i < numPendingBytes; ++i)
+        {
+            if (pending[i] == 0xf7)
+            {
+                if (o) o->simulatorSysex(pending + start, i + 1 - start);
+                start = i + 1;
+            }
+        }
+        numPendingBytes = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void getMotion(const double t, float* ypr) const
+    {
+        if (!recording.empty())
+        {
+            const size_t numFrames = recording.size() / 3;
+            const size_t frame = static_cast<size_t>(t * recordingRate) % numFrames;
+            memcpy(ypr, &recording[3 * frame], 3 * sizeof(float));
+            return;
+        }
+        for (uint8_t i = 0; i < 3; ++i)
+        {
+            ypr[i] = amplitude[i] * static_cast<float>(sin(2.0 * Pi * frequency[i] * t));
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    void sendFrame(const double t)
+    {
+        float ypr[3];
+        getMotion(t, ypr);
+        ypr[0] -= zeroYaw;
+        if (ypr[0] > Pi) ypr[0] -= 2.0f * Pi;
+        if (ypr[0] < -Pi) ypr[0] += 2.0f * Pi;
+
+        uint8_t frame[MaxMessageBytes] = { 0xf0, 0x00, 0x21, 0x42, 0x40 };
+        size_t size = 6;
+        const uint8_t format = (registers[RegisterOutputFormat] >> 2) & 3;
+        if (format == 0)
+        {
+            frame[5] = 0x00;
+            for (uint8_t i = 0; i < 3; ++i, size += 2)
+            {
+                floatToBytes211(ypr[i], frame + size);
+            }
+        }
+        else
+        {
+            headMatrix.setOrientationYPR(ypr[0], ypr[1], ypr[2]);
+            const float* m = headMatrix.getMatrix();
+            if (format == 1)
+            {
+                float q[4];
+                matrixToQuaternion(m, q);
+                frame[5] = 0x01;
+                for (uint8_t i = 0; i < 4; ++i, size += 2)
+                {
+                    floatToBytes211(q[i], frame + size);
+                }
+            }
+            else
+            {
+                frame[5] = 0x02;
+                for (uint8_t i = 0; i < 9; ++i, size += 2)
+                {
+                    floatToBytes211(m[i], frame + size);
+                }
+            }
+        }
+        frame[size++] = 0xf7;
+        ++numFramesSent;
+        if (o) o->simulatorSysex(frame, size);
+    }
+
+    // ------------------------------------------------------------------------
+
+    static void matrixToQuaternion(const float* m, float* q)
+    {
+        // the inverse of HeadMatrix::setOrientationQuaternion, taking the
+        // largest diagonal term for accuracy; q is w, x, y, z
+        const float trace = m[0] + m[4] + m[8];
+        if (trace > 0.0f)
+        {
+            const float s = 2.0f * sqrtf(1.0f + trace);
+            q[0] = 0.25f * s;
+            q[1] = (m[7] - m[5]) / s;
+            q[2] = (m[2] - m[6]) / s;
+            q[3] = (m[3] - m[1]) / s;
+        }
+        else if ((m[0] > m[4]) && (m[0] > m[8]))
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[0] - m[4] - m[8]);
+            q[0] = (m[7] - m[5]) / s;
+            q[1] = 0.25f * s;
+            q[2] = (m[1] + m[3]) / s;
+            q[3] = (m[2] + m[6]) / s;
+        }
+        else if (m[4] > m[8])
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[4] - m[0] - m[8]);
+            q[0] = (m[2] - m[6]) / s;
+            q[1] = (m[1] + m[3]) / s;
+            q[2] = 0.25f * s;
+            q[3] = (m[5] + m[7]) / s;
+        }
+        else
+        {
+            const float s = 2.0f * sqrtf(1.0f + m[8] - m[0] - m[4]);
+            q[0] = (m[3] - m[1]) / s;
+            q[1] = (m[2] + m[6]) / s;
+            q[2] = (m[5] + m[7]) / s;
+            q[3] = 0.25f * s;
+        }
+    }
+};
@@ -0,0 +1,358 @@
+/*
+ * VBAP layout: triangulation and gain calculation for a loudspeaker layout
+ * This class doesn't need JUCE!
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/** Vector base amplitude panning over a fixed layout of loudspeakers. The
+    triangulation (the convex hull of the loudspeaker directions) and the
+    inverse of each triangle's matrix are worked out once, in setSpeakers().
+    After that, finding the gains for a direction is a cached triangle test,
+    then a cube-map lookup, and only then a search of every triangle.
+    Directions use the same axes as HeadMatrix. The layout should surround
+    the listener: if it doesn't (no loudspeakers below the horizon, say),
+    add a virtual loudspeaker to close the hull. */
+class VbapLayout
+{
+public:
+    VbapLayout() {}
+
+    // ------------------------------------------------------------------------
+
+    /** Takes numSpeakers x/y/z triplets, which needn't be normalised.
+        This allocates memory, so don't call it from the audio thread. */
+    void setSpeakers(const float* xyz, const int numSpeakers)
+    {
+        speakers.assign(xyz, xyz + 3 * numSpeakers);
+        for (int i = 0; i < numSpeakers; ++i)
+        {
+            normalise(&speakers[3 * i]);
+        }
+        triangulate();
+        buildCubeMap();
+    }
+
+    // ------------------------------------------------------------------------
+
+    int getNumSpeakers() const
+    {
+        return static_cast<int>(speakers.size() / 3);
+    }
+
+    // ------------------------------------------------------------------------
+
+    int getNumTriangles() const
+    {
+        return static_cast<int>(triangles.size());
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Finds the three loudspeakers and their power-normalised gains for a
+        direction. hint should be the triangle returned last time for the same
+        source (or -1): it's tested first, because sources rarely change
+        triangle between tracker frames. Returns the triangle used, or -1 if
+        the layout is empty. */
+    int findGains(float x, float y, float z, int hint, int speakerIndex[3], float gain[3]) const
+    {
+        if (triangles.empty())
+        {
+            return -1;
+        }
+
+        float p[3] = { x, y, z };
+        normalise(p);
+
+        if ((hint >= 0) && (hint < getNumTriangles()) && tryTriangle(hint, p, speakerIndex, gain))
+        {
+            return hint;
+        }
+
+        const Cell& cell = cubeMap[cellIndex(p)];
+        for (uint8_t i = 0; i < cell.count; ++i)
+        {
+            if (tryTriangle(cell.candidate[i], p, speakerIndex, gain))
+            {
+                return cell.candidate[i];
+            }
+        }
+
+        // Exhaustive search. If no triangle contains the direction (because the
+        // hull is open) use the one that needs the least negative gain.
+        int best = 0;
+        float bestWorst = -1e9f;
+        for (int t = 0; t < getNumTriangles(); ++t)
+        {
+            float g[3];
+            unnormalisedGains(t, p, g);
+            const float worst = fminf(g[0], fminf(g[1], g[2]));
+            if (worst > bestWorst)
+            {
+                bestWorst = worst;
+                best = t;
+            }
+            if (worst >= -Tolerance)
+            {
+                break;
+            }
+        }
+        float g[3];
+        unnormalisedGains(best, p, g);
+        for (uint8_t k = 0; k < 3; ++k)
+        {
+            if (g[k] < 0.0f) g[k] = 0.0f;
+        }
+        finishGains(best, g, speakerIndex, gain);
+        return best;
+    }
+
+    // ------------------------------------------------------------------------
+
+private:
+    static constexpr float Tolerance = 1e-4f;
+    static constexpr int CubeMapSize = 16;
+    static constexpr int MaxCandidates = 6;
+
+    struct Triangle
+    {
+        int speaker[3];
+        float inverse[9]; // row-major; row k gives loudspeaker k's gain
+    };
+
+    struct Cell
+    {
+        int candidate[MaxCandidates];
+        uint8_t count;
+    };
+
+    std::vector<float> speakers;
+    std::vector<Triangle> triangles;
+    std::vector<Cell> cubeMap;
+
+    // ------------------------------------------------------------------------
+
+    static void normalise(float* v)
+    {
+        const float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0.0f)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    void unnormalisedGains(const int t, const float* p, float* g) const
+    {
+        const float* inv = triangles[t].inverse;
+        g[0] = inv[0] * p[0] + inv[1] * p[1] + inv[2] * p[2];
+        g[1] = inv[3] * p[0] + inv[4] * p[1] + inv[5] * p[2];
+        g[2] = inv[6] * p[0] + inv[7] * p[1] + inv[8] * p[2];
+    }
+
+    // ------------------------------------------------------------------------
+
+    void finishGains(const int t, float* g, int speakerIndex[3], float gain[3]) const
+    {
+        const float power = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+        const float scale = (power > 0.0f) ? 1.0f / sqrtf(power) : 0.0f;
+        for (uint8_t k = 0; k < 3; ++k)
+        {
+            speakerIndex[k] = triangles[t].speaker[k];
+            gain[k] = (g[k] > 0.0f) ? g[k] * scale : 0.0f;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool tryTriangle(const int t, const float* p, int speakerIndex[3], float gain[3]) const
+    {
+        float g[3];
+        unnormalisedGains(t, p, g);
+        if ((g[0] < -Tolerance) || (g[1] < -Tolerance) || (g[2] < -Tolerance))
+        {
+            return false;
+        }
+        finishGains(t, g, speakerIndex, gain);
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void triangulate()
+    {
+        // Brute-force convex hull: a triangle is a hull face if no loudspeaker
+        // lies outside its plane. This is O(n^4), but it only runs once.
+        triangles.clear();
+        const int n = getNumSpeakers();
+        const float* s = speakers.data();
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = i + 1; j < n; ++j)
+            {
+                for (int k = j + 1; k < n; ++k)
+                {
+                    const float* a = &s[3 * i];
+                    const float* b = &s[3 * j];
+                    const float* c = &s[3 * k];
+                    float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                    float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                    float normal[3] = { u[1] * v[2] - u[2] * v[1],
+                                        u[2] * v[0] - u[0] * v[2],
+                                        u[0] * v[1] - u[1] * v[0] };
+                    float d = normal[0] * a[0] + normal[1] * a[1] + normal[2] * a[2];
+                    if (d < 0.0f)
+                    {
+                        normal[0] = -normal[0];
+                        normal[1] = -normal[1];
+                        normal[2] = -normal[2];
+                        d = -d;
+                    }
+                    if (d < Tolerance)
+                    {
+                        // plane passes through the listener: no use for panning
+                        continue;
+                    }
+
+                    bool isFace = true;
+                    for (int q = 0; (q < n) && isFace; ++q)
+                    {
+                        const float* e = &s[3 * q];
+                        isFace = (normal[0] * e[0] + normal[1] * e[1] + normal[2] * e[2]) <= d + Tolerance;
+                    }
+                    if (isFace)
+                    {
+                        Triangle t;
+                        t.speaker[0] = i;
+                        t.speaker[1] = j;
+                        t.speaker[2] = k;
+                        if (invert(a, b, c, t.inverse))
+                        {
+                            triangles.push_back(t);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    static bool invert(const float* a, const float* b, const float* c, float* inverse)
+    {
+        // The matrix has a, b and c as columns, so that p = M g. Its inverse
+        // has rows b x c, c x a and a x b, divided by the determinant.
+        const float bc[3] = { b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0] };
+        const float ca[3] = { c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0] };
+        const float ab[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+        const float det = a[0] * bc[0] + a[1] * bc[1] + a[2] * bc[2];
+        if (fabsf(det) < Tolerance)
+        {
+            return false;
+        }
+        for (uint8_t i = 0; i < 3; ++i)
+        {
+            inverse[i]     = bc[i] / det;
+            inverse[3 + i] = ca[i] / det;
+            inverse[6 + i] = ab[i] / det;
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    static int cellIndex(const float* p)
+    {
+        // cube map: the largest component picks a face, the other two a cell
+        const float ax = fabsf(p[0]);
+        const float ay = fabsf(p[1]);
+        const float az = fabsf(p[2]);
+        int face;
+        float u, v, major;
+        if ((ax >= ay) && (ax >= az)) { face = (p[0] >= 0.0f) ? 0 : 1; u = p[1]; v = p[2]; major = ax; }
+        else if (ay >= az)            { face = (p[1] >= 0.0f) ? 2 : 3; u = p[0]; v = p[2]; major = ay; }
+        else                          { face = (p[2] >= 0.0f) ? 4 : 5; u = p[0]; v = p[1]; major = az; }
+        if (major <= 0.0f)
+        {
+            return 0;
+        }
+        int iu = static_cast<int>((u / major + 1.0f) * 0.5f * CubeMapSize);
+        int iv = static_cast<int>((v / major + 1.0f) * 0.5f * CubeMapSize);
+        if (iu >= CubeMapSize) iu = CubeMapSize - 1;
+        if (iv >= CubeMapSize) iv = CubeMapSize - 1;
+        if (iu < 0) iu = 0;
+        if (iv < 0) iv = 0;
+        return (face * CubeMapSize + iu) * CubeMapSize + iv;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void buildCubeMap()
+    {
+        // Sample each cell on a small grid, and remember the triangles found.
+        // Directions that the samples miss still work: they fall through to
+        // the exhaustive search.
+        constexpr int Samples = 3;
+        cubeMap.assign(6 * CubeMapSize * CubeMapSize, Cell());
+        for (Cell& cell : cubeMap)
+        {
+            cell.count = 0;
+        }
+        for (int face = 0; face < 6; ++face)
+        {
+            for (int iu = 0; iu < CubeMapSize; ++iu)
+            {
+                for (int iv = 0; iv < CubeMapSize; ++iv)
+                {
+                    Cell& cell = cubeMap[(face * CubeMapSize + iu) * CubeMapSize + iv];
+                    for (int su = 0; su <= Samples; ++su)
+                    {
+                        for (int sv = 0; sv <= Samples; ++sv)
+                        {
+                            const float u = 2.0f * (static_cast<float>(iu) + static_cast<float>(su) / Samples) / CubeMapSize - 1.0f;
+                            const float v = 2.0f * (static_cast<float>(iv) + static_cast<float>(sv) / Samples) / CubeMapSize - 1.0f;
+                            const float sign = (face & 1) ? -1.0f : 1.0f;
+                            float p[3];
+                            if (face < 2)      { p[0] = sign; p[1] = u;    p[2] = v; }
+                            else if (face < 4) { p[0] = u;    p[1] = sign; p[2] = v; }
+                            else               { p[0] = u;    p[1] = v;    p[2] = sign; }
+                            normalise(p);
+                            addCandidate(cell, p);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    void addCandidate(Cell& cell, const float* p) const
+    {
+        for (int t = 0; t < getNumTriangles(); ++t)
+        {
+            float g[3];
+            unnormalisedGains(t, p, g);
+            if ((g[0] >= -Tolerance) && (g[1] >= -Tolerance) && (g[2] >= -Tolerance))
+            {
+                for (uint8_t i = 0; i < cell.count; ++i)
+                {
+                    if (cell.candidate[i] == t) return;
+                }
+                if (cell.count < MaxCandidates)
+                {
+                    cell.candidate[cell.count++] = t;
+                }
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,152 @@
+/*
+ * Audio processors
+ * Head-tracked rotation of an Ambisonic sound field
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Audio
+{
+    /** Rotates an ACN-ordered Ambisonic buffer, in place, so that the sound field
+        stays fixed in the room while the head turns. When the orientation changes
+        between blocks, each output sample is mixed from the old and new rotation
+        matrices with a linear crossfade across the block, so there's no zipper
+        noise. The rotation is applied order by order, using JUCE's vectorised
+        buffer operations. */
+    class AmbisonicRotator
+    {
+    public:
+        AmbisonicRotator() :
+            order(0),
+            maxBlockSize(0),
+            rampSize(0)
+        {
+            for (uint8_t i = 0; i < 9; ++i)
+            {
+                lastMatrix[i] = (i & 3) ? 0.f : 1.f;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Allocates working buffers: call this before processing starts, and
+            not from the audio thread. The order may be between 1 and 5. */
+        void prepare(const int ambisonicOrder, const int maximumBlockSize)
+        {
+            jassert((ambisonicOrder >= 1) && (ambisonicOrder <= AmbisonicMatrix::MaxOrder));
+            order = ambisonicOrder;
+            maxBlockSize = maximumBlockSize;
+            scratch.setSize(2 * order + 1, maxBlockSize);
+            difference.setSize(1, maxBlockSize);
+            ramp.setSize(1, maxBlockSize);
+            rampSize = 0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        int getNumChannels() const
+        {
+            return AmbisonicMatrix::getNumChannels(order);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Rotates the first getNumChannels() channels of the buffer to the current
+            orientation. Call this from the audio thread, once per block. */
+        void process(juce::AudioBuffer<float>& buffer, const HeadMatrix& headMatrix)
+        {
+            const int numSamples = buffer.getNumSamples();
+            jassert(buffer.getNumChannels() >= getNumChannels());
+            jassert(numSamples <= maxBlockSize);
+            if (numSamples == 0) return;
+
+            const float* mat = headMatrix.getMatrix();
+            bool isFading = false;
+            for (uint8_t i = 0; i < 9; ++i)
+            {
+                if (mat[i] != lastMatrix[i])
+                {
+                    isFading = true;
+                    lastMatrix[i] = mat[i];
+                }
+            }
+
+            if (isFading)
+            {
+                target.setOrientation(headMatrix);
+                if (rampSize != numSamples)
+                {
+                    float* r = ramp.getWritePointer(0);
+                    const float step = 1.0f / static_cast<float>(numSamples);
+                    for (int i = 0; i < numSamples; ++i)
+                    {
+                        r[i] = static_cast<float>(i + 1) * step;
+                    }
+                    rampSize = numSamples;
+                }
+            }
+
+            // order 0 is unaffected by rotation
+            for (int l = 1; l <= order; ++l)
+            {
+                rotateOrder(buffer, l, numSamples, isFading);
+            }
+
+            if (isFading)
+            {
+                current = target;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        AmbisonicMatrix current, target;
+        juce::AudioBuffer<float> scratch, difference, ramp;
+        float lastMatrix[9];
+        int order, maxBlockSize, rampSize;
+
+        // ------------------------------------------------------------------------
+
+        void rotateOrder(juce::AudioBuffer<float>& buffer, const int l, const int numSamples, const bool isFading)
+        {
+            const int width = 2 * l + 1;
+            const int firstChannel = AmbisonicMatrix::getFirstChannel(l);
+            const float* oldMatrix = current.getOrderMatrix(l);
+            const float* newMatrix = target.getOrderMatrix(l);
+
+            for (int j = 0; j < width; ++j)
+            {
+                scratch.copyFrom(j, 0, buffer, firstChannel + j, 0, numSamples);
+            }
+
+            for (int i = 0; i < width; ++i)
+            {
+                float* out = buffer.getWritePointer(firstChannel + i);
+                const float* oldRow = oldMatrix + i * width;
+                juce::FloatVectorOperations::copyWithMultiply(out, scratch.getReadPointer(0), oldRow[0], numSamples);
+                for (int j = 1; j < width; ++j)
+                {
+                    if (oldRow[j] != 0.0f)
+                    {
+                        juce::FloatVectorOperations::addWithMultiply(out, scratch.getReadPointer(j), oldRow[j], numSamples);
+                    }
+                }
+
+                if (isFading)
+                {
+                    // out += ramp * (new - old) * in
+                    float* diff = difference.getWritePointer(0);
+                    const float* newRow = newMatrix + i * width;
+                    juce::FloatVectorOperations::copyWithMultiply(diff, scratch.getReadPointer(0), newRow[0] - oldRow[0], numSamples);
+                    for (int j = 1; j < width; ++j)
+                    {
+                        juce::FloatVectorOperations::addWithMultiply(diff, scratch.getReadPointer(j), newRow[j] - oldRow[j], numSamples);
+                    }
+                    juce::FloatVectorOperations::addWithMultiply(out, ramp.getReadPointer(0), diff, numSamples);
+                }
+            }
+        }
+    };
+};
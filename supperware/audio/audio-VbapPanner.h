@@ -0,0 +1,201 @@
+/*
+ * Audio processors
+ * Head-tracked VBAP panning onto virtual loudspeakers
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Audio
+{
+    /** Pans many room-fixed mono sources onto a head-fixed layout of virtual
+        loudspeakers (the usual arrangement for binaural rendering). Rather than
+        rotating the loudspeakers and re-triangulating on every frame, each
+        source is rotated into head coordinates, so the layout's triangulation
+        and inverse matrices never change. Gains are only recalculated when the
+        orientation or a source moves, and each source starts its search from
+        the triangle it was in last time. Changes are ramped across the block. */
+    class VbapPanner
+    {
+    public:
+        VbapPanner() :
+            maxBlockSize(0)
+        {
+            for (uint8_t i = 0; i < 9; ++i)
+            {
+                lastMatrix[i] = (i & 3) ? 0.f : 1.f;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sets up the virtual loudspeakers, as x/y/z triplets in head coordinates,
+            and allocates per-source state. Don't call this from the audio thread. */
+        void prepare(const float* speakerXyz, const int numSpeakers, const int numSources, const int maximumBlockSize)
+        {
+            layout.setSpeakers(speakerXyz, numSpeakers);
+            maxBlockSize = maximumBlockSize;
+            sources.assign(static_cast<size_t>(numSources), Source());
+        }
+
+        // ------------------------------------------------------------------------
+
+        const VbapLayout& getLayout() const
+        {
+            return layout;
+        }
+
+        // ------------------------------------------------------------------------
+
+        int getNumSources() const
+        {
+            return static_cast<int>(sources.size());
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Moves a source, in room coordinates. The new gains are picked up, and
+            ramped to, by the next call to process(). */
+        void setSourceDirection(const int sourceIndex, const float x, const float y, const float z)
+        {
+            Source& s = sources[static_cast<size_t>(sourceIndex)];
+            s.direction[0] = x;
+            s.direction[1] = y;
+            s.direction[2] = z;
+            s.isDirty = true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Pans one input channel per source into one output channel per virtual
+            loudspeaker, adding to whatever the output buffer already holds.
+            Call this from the audio thread. */
+        void process(const HeadMatrix& headMatrix, const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+        {
+            const int numSamples = input.getNumSamples();
+            jassert(input.getNumChannels() >= getNumSources());
+            jassert(output.getNumChannels() >= layout.getNumSpeakers());
+            jassert(numSamples <= maxBlockSize);
+
+            updateGains(headMatrix);
+
+            for (size_t i = 0; i < sources.size(); ++i)
+            {
+                Source& s = sources[i];
+                const float* in = input.getReadPointer(static_cast<int>(i));
+
+                // ramp out the old loudspeakers, or across to their new gains
+                for (uint8_t k = 0; k < 3; ++k)
+                {
+                    if (s.current.speaker[k] < 0) continue;
+                    const float start = s.current.gain[k];
+                    const float end = s.target.gainFor(s.current.speaker[k]);
+                    if ((start != 0.0f) || (end != 0.0f))
+                    {
+                        output.addFromWithRamp(s.current.speaker[k], 0, in, numSamples, start, end);
+                    }
+                }
+                // ramp in loudspeakers that have just been added
+                for (uint8_t k = 0; k < 3; ++k)
+                {
+                    if ((s.target.speaker[k] >= 0) && (s.target.gain[k] != 0.0f) && !s.current.contains(s.target.speaker[k]))
+                    {
+                        output.addFromWithRamp(s.target.speaker[k], 0, in, numSamples, 0.0f, s.target.gain[k]);
+                    }
+                }
+                s.current = s.target;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        struct Gains
+        {
+            int speaker[3];
+            float gain[3];
+
+            Gains()
+            {
+                for (uint8_t k = 0; k < 3; ++k)
+                {
+                    speaker[k] = -1;
+                    gain[k] = 0.0f;
+                }
+            }
+
+            bool contains(const int speakerIndex) const
+            {
+                for (uint8_t k = 0; k < 3; ++k)
+                {
+                    if (speaker[k] == speakerIndex) return true;
+                }
+                return false;
+            }
+
+            float gainFor(const int speakerIndex) const
+            {
+                for (uint8_t k = 0; k < 3; ++k)
+                {
+                    if (speaker[k] == speakerIndex) return gain[k];
+                }
+                return 0.0f;
+            }
+        };
+
+        struct Source
+        {
+            float direction[3];
+            Gains current, target;
+            int triangle;
+            bool isDirty;
+
+            Source() :
+                triangle(-1),
+                isDirty(true)
+            {
+                direction[0] = 0.0f;
+                direction[1] = 1.0f;
+                direction[2] = 0.0f;
+            }
+        };
+
+        VbapLayout layout;
+        std::vector<Source> sources;
+        float lastMatrix[9];
+        int maxBlockSize;
+
+        // ------------------------------------------------------------------------
+
+        void updateGains(const HeadMatrix& headMatrix)
+        {
+            const float* mat = headMatrix.getMatrix();
+            bool hasRotated = false;
+            for (uint8_t i = 0; i < 9; ++i)
+            {
+                if (mat[i] != lastMatrix[i])
+                {
+                    hasRotated = true;
+                    lastMatrix[i] = mat[i];
+                }
+            }
+
+            for (Source& s : sources)
+            {
+                if (hasRotated || s.isDirty)
+                {
+                    float x = s.direction[0];
+                    float y = s.direction[1];
+                    float z = s.direction[2];
+                    headMatrix.transformTranspose(x, y, z);
+                    s.triangle = layout.findGains(x, y, z, s.triangle, s.target.speaker, s.target.gain);
+                    if (s.triangle < 0)
+                    {
+                        s.target = Gains();
+                    }
+                    s.isDirty = false;
+                }
+            }
+        }
+    };
+};
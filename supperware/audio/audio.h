@@ -0,0 +1,10 @@
+/*
+ * Audio processors
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+#define AUDIO_H_INCLUDED
+
+#include "audio-AmbisonicRotator.h"
+#include "audio-VbapPanner.h"
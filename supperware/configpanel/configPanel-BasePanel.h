@@ -26,7 +26,8 @@ private juce::Button::Listener, private juce::ComboBox::Listener, private juce::
             doRepaint(false)
         {
             setOpaque(false);
-            td.addListener(this);
+            // panels show settings and state, so they don't need every frame
+            td.addListener(this, Midi::TrackerDriver::AllEvents & ~Midi::TrackerDriver::OrientationEvents);
 
 
         }
@@ -35,11 +36,20 @@ private juce::Button::Listener, private juce::ComboBox::Listener, private juce::
 
         ~BasePanel()
         {
+            // the driver may be shared, and outlive this panel
+            td.removeListener(this);
             for (auto tb : toggleButtons) { tb->setLookAndFeel(nullptr); }
         }
 
         // ---------------------------------------------------------------------
 
+        juce::String getListenerName() const override
+        {
+            return title.isEmpty() ? "Settings panel" : title;
+        }
+
+        // ---------------------------------------------------------------------
+
         virtual void click(juce::Button*, const bool /*isTextButton*/, const int /*index*/, const bool /*isChecked*/) {}
         virtual void comboBox(const int /*index*/, const int /*option*/) {}
         virtual void setUdpPort(int /*newPort*/) {}
@@ -12,7 +12,8 @@ namespace ConfigPanel
     public:
         SettingsPanel(Midi::TrackerDriver& trackerDriver):
             BasePanel(trackerDriver, nullptr, ""),
-            compassState(Tracker::CompassState::Off)
+            compassState(Tracker::CompassState::Off),
+            panelTiming(nullptr)
         {
             juce::Point<int> position(4, yOrigin());
             addLabel(position, "Chirality", LabelStyle::SectionHeading);
@@ -53,8 +54,22 @@ namespace ConfigPanel
             position.addXY(-120, 0);
             addTextButton(position, "Reconnect", 172);
 
+            position.addXY(0, 10);
+            addLabel(position, "Listener timing", LabelStyle::SectionHeading);
+            const int timingToggle = addToggle(position, "Time each listener", -1);
+            jassert(timingToggle == TimingToggle);
+            juce::ignoreUnused(timingToggle);
+            slowestLabel = addLabel(position, "", LabelStyle::SubData, false, true, true);
+            budgetLabel = addLabel(position, "", LabelStyle::SubData, false, true, true);
+            toggleButtons[TimingToggle]->setToggleState(td.isListenerTiming(), juce::dontSendNotification);
+            if (td.isListenerTiming())
+            {
+                startTimer(2, 500);
+            }
+
             setSize(LabelWidth, position.y + 2);
             setEnabled(true);
+            refreshAsync(); // a shared driver may already be connected
 
             // OSC
             if (!oscSender.connect(oscAddress, udpPort))   //
@@ -86,6 +101,7 @@ namespace ConfigPanel
                 case 4: if (isChecked) td.setTravelMode(Tracker::TravelMode::Off);     break;
                 case 5: if (isChecked) td.setTravelMode(Tracker::TravelMode::Slow);    break;
                 case 6: if (isChecked) td.setTravelMode(Tracker::TravelMode::Fast);    break;
+                case TimingToggle: setListenerTiming(isChecked);                      break;
                 }
             }
         }
@@ -118,6 +134,16 @@ namespace ConfigPanel
 
         // ---------------------------------------------------------------------
 
+        /** Includes a listener that isn't the driver's (such as the head
+            panel's own) in the timing report. */
+        void setPanelListenerTiming(const juce::String& name, const Midi::CallTiming* timing)
+        {
+            panelTimingName = name;
+            panelTiming = timing;
+        }
+
+        // ---------------------------------------------------------------------
+
         void reconnectOscSender() {
             oscSender.connect(oscAddress, udpPort);
         }
@@ -164,6 +190,12 @@ namespace ConfigPanel
         juce::String oscAddress = "127.0.0.1";
         juce::String oscString = "/ypr";
 
+        int slowestLabel, budgetLabel;
+        juce::String panelTimingName;
+        const Midi::CallTiming* panelTiming;
+        static constexpr int TimingToggle { 7 }; // the eighth toggle added
+        static constexpr int TimingPercentile { 99 };
+
         // ---------------------------------------------------------------------
 
         void refreshAsync()
@@ -173,10 +205,68 @@ namespace ConfigPanel
 
         // ---------------------------------------------------------------------
 
+        void setListenerTiming(const bool shouldTime)
+        {
+            td.setListenerTiming(shouldTime);
+            if (shouldTime)
+            {
+                startTimer(2, 500);
+            }
+            else
+            {
+                stopTimer(2);
+                labels[slowestLabel]->setText("", juce::dontSendNotification);
+                labels[budgetLabel]->setText("", juce::dontSendNotification);
+            }
+        }
+
+        // ---------------------------------------------------------------------
+
+        /** Shows the listener with the slowest 99th percentile, and how many
+            have gone over budget. */
+        void showListenerTiming()
+        {
+            juce::String slowestName;
+            uint64_t slowest = 0;
+            int numListeners = 0, numOverBudget = 0;
+            auto consider = [&](const juce::String& name, const Midi::CallTiming& timing)
+            {
+                ++numListeners;
+                numOverBudget += timing.isOverBudget() ? 1 : 0;
+                const uint64_t p = timing.histogram.getPercentile(TimingPercentile);
+                if ((p > slowest) || slowestName.isEmpty())
+                {
+                    slowest = p;
+                    slowestName = name;
+                }
+            };
+
+            for (const Midi::TrackerDriver::ListenerTiming& t : td.getListenerTimings())
+            {
+                consider(t.name, *t.timing);
+            }
+            if (panelTiming)
+            {
+                consider(panelTimingName, *panelTiming);
+            }
+
+            labels[slowestLabel]->setText("Slowest: " + slowestName + ", " + juce::String(static_cast<int>(slowest)) +
+                juce::CharPointer_UTF8(" \xc2\xb5s"), juce::dontSendNotification);
+            labels[budgetLabel]->setText(juce::String(numOverBudget) + " of " + juce::String(numListeners) + " over " +
+                juce::String(td.getListenerBudgetMicroseconds()) + juce::CharPointer_UTF8(" \xc2\xb5s"), juce::dontSendNotification);
+        }
+
+        // ---------------------------------------------------------------------
+
         void timerCallback(int timerID) override
         {
             BasePanel::timerCallback(timerID);
 
+            if (timerID == 2)
+            {
+                showListenerTiming();
+            }
+
             if (timerID == 1)
             {
                 stopTimer(1);
@@ -9,8 +9,9 @@
 namespace HeadPanel
 {
     /** Component that manages head tracker settings, disconnection/reconnection, and shows 
-      * instantaneous head angle. Also owns Midi::Tracker and SBR::HeadMatrix objects, which
-      * are useful everywhere else. */
+      * instantaneous head angle. Also owns a HeadMatrix, which is useful everywhere else.
+      * The Midi::TrackerDriver belongs to the process's TrackerHub, so every panel (in every
+      * plugin instance) shares one connection; each panel holds its own stream lease. */
     class HeadPanel: public juce::Component, juce::Timer, Midi::TrackerDriver::Listener, HeadButton::Listener
 
     {
@@ -24,22 +25,35 @@ namespace HeadPanel
 
         HeadPanel() :
             listener(nullptr),
+            trackerDriver(hub->getDriver()),
+            hasLease(false),
             settingsPanel(trackerDriver),
             hbConfigure(this, 0),
             hbConnect(this, 1),
             doRepaint(false),
             gazeInitial(0),
             gazeNow(0),
-            midiState(Midi::State::Unavailable)
+            midiState(Midi::State::Unavailable),
+            queuedListener(trackerDriver, this, 4, Midi::OverflowPolicy::KeepNewest)
         {
             juce::MemoryInputStream mis(BinaryData::mini_tile_png, BinaryData::mini_tile_pngSize, false);
             juce::Image im = juce::ImageFileFormat::loadFrom(mis);
 
-            trackerDriver.addListener(this);
             setSize(148, 104);
             doButton(hbConfigure, im, 0, 2, 6);
             doButton(hbConnect, im, 1, 2, 58);
             hbConnect.setVisible(false);
+            settingsPanel.setPanelListenerTiming("Head panel listener", &listenerTiming);
+
+            // another instance may have connected already: if so, this takes a lease
+            trackerMidiConnectionChanged(trackerDriver.getConnectionState());
+        }
+
+        //----------------------------------------------------------------------
+
+        ~HeadPanel()
+        {
+            releaseLease();
         }
         //----------------------------------------------------------------------
 
@@ -50,9 +64,11 @@ namespace HeadPanel
 
         //----------------------------------------------------------------------
 
-        const HeadMatrix& getHeadMatrix() const
+        /** Copies the latest orientation. */
+        void getHeadMatrix(HeadMatrix& destination) const
         {
-            return headMatrix;
+            const juce::ScopedLock sl(matrixLock);
+            destination.setOrientationMatrix(headMatrix.getMatrix());
         }
 
         //----------------------------------------------------------------------
@@ -60,6 +76,7 @@ namespace HeadPanel
         void paint(juce::Graphics& g) override
         {
             constexpr int HeadSize = 48;
+            const juce::ScopedLock sl(matrixLock);
             plot.paint(g, HeadSize + 50, HeadSize + 4, static_cast<float>(HeadSize), 2.0f, midiState);
         }
 
@@ -67,9 +84,12 @@ namespace HeadPanel
 
         void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
         {
-            headMatrix.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
-            plot.recalculate(headMatrix);
-            if (listener) listener->trackerChanged(headMatrix);
+            {
+                const juce::ScopedLock sl(matrixLock);
+                headMatrix.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+                plot.recalculate(headMatrix);
+                notifyListener();
+            }
             flagRepaint();
         }
 
@@ -77,9 +97,12 @@ namespace HeadPanel
 
         void trackerOrientationQ(float qw, float qx, float qy, float qz) override
         {
-            headMatrix.setOrientationQuaternion(qw, qx, qy, qz);
-            plot.recalculate(headMatrix);
-            if (listener) listener->trackerChanged(headMatrix);
+            {
+                const juce::ScopedLock sl(matrixLock);
+                headMatrix.setOrientationQuaternion(qw, qx, qy, qz);
+                plot.recalculate(headMatrix);
+                notifyListener();
+            }
             flagRepaint();
         }
 
@@ -91,6 +114,11 @@ namespace HeadPanel
             {
                 midiState = newState;
 
+                if (midiState == Midi::State::Connected)
+                {
+                    // whichever instance connected, every panel shares the stream
+                    takeLease();
+                }
                 if ((midiState == Midi::State::Connected) || (midiState == Midi::State::Bootloader))
                 {
                     hbConnect.setVisible(true);
@@ -100,20 +128,33 @@ namespace HeadPanel
                 {
                     hbConnect.setVisible(true);
                     hbConnect.setSelected(false);
-                    headMatrix.zero();
                 }
                 else // Unavailable
                 {
                     hbConnect.setVisible(false);
-                    headMatrix.zero();
                 }
-                if (listener) listener->trackerChanged(headMatrix);
+
+                {
+                    const juce::ScopedLock sl(matrixLock);
+                    if ((midiState == Midi::State::Available) || (midiState == Midi::State::Unavailable))
+                    {
+                        headMatrix.zero();
+                    }
+                    notifyListener();
+                }
                 flagRepaint();
             }
         }
 
         //----------------------------------------------------------------------
 
+        juce::String getListenerName() const override
+        {
+            return "Head panel";
+        }
+
+        //----------------------------------------------------------------------
+
         void trackerConnectionChanged(const Tracker::State& state) override
         {
             settingsPanel.trackUpdatedState(state.rightEarChirality, state.compassOn, state.travelMode);
@@ -174,15 +215,25 @@ namespace HeadPanel
             }
             else if (index == 1)
             {
-                // connect/disconnect button
+                // connect/disconnect button: the connection is shared, so this
+                // panel only disconnects if nobody else wants the stream
                 if (midiState == Midi::State::Available)
                 {
                     trackerDriver.connect();
-                    trackerDriver.turnOn(false, true);
+                    takeLease();
+                }
+                else if ((midiState == Midi::State::Connected) && !hasLease)
+                {
+                    // this panel let go, but another kept the connection: join it again
+                    takeLease();
                 }
                 else
                 {
-                    trackerDriver.disconnect();
+                    releaseLease();
+                    if (trackerDriver.getNumStreamLeases() == 0)
+                    {
+                        trackerDriver.disconnect();
+                    }
                 }
             }
         }
@@ -236,7 +287,11 @@ namespace HeadPanel
 
     private:
         Listener* listener;
-        Midi::TrackerDriver trackerDriver;
+        Midi::SharedTrackerHub hub;
+        Midi::TrackerDriver& trackerDriver;
+        bool hasLease;
+        // orientation arrives on the queue's thread, connection changes on the message thread
+        juce::CriticalSection matrixLock;
         HeadMatrix headMatrix;
         ConfigPanel::SettingsPanel settingsPanel;
 
@@ -246,9 +301,51 @@ namespace HeadPanel
         float gazeInitial, gazeNow;
 
         Midi::State midiState;
+        Midi::CallTiming listenerTiming;
+        // last, so that it stops delivering before anything else is destroyed
+        Midi::QueuedListener queuedListener;
 
         //----------------------------------------------------------- ----------
 
+        void takeLease()
+        {
+            if (!hasLease)
+            {
+                hasLease = true;
+                trackerDriver.acquireStream(false, true);
+            }
+        }
+
+        void releaseLease()
+        {
+            if (hasLease)
+            {
+                hasLease = false;
+                trackerDriver.releaseStream();
+            }
+        }
+
+        //----------------------------------------------------------------------
+
+        /** Timed along with the driver's listeners, when they are. Called with
+            matrixLock held. */
+        void notifyListener()
+        {
+            if (!listener)
+            {
+                return;
+            }
+            if (!trackerDriver.isListenerTiming())
+            {
+                listener->trackerChanged(headMatrix);
+                return;
+            }
+            listenerTiming.time([this] { listener->trackerChanged(headMatrix); },
+                static_cast<uint64_t>(trackerDriver.getListenerBudgetMicroseconds()));
+        }
+
+        //----------------------------------------------------------------------
+
         void flagRepaint()
         {
             if (!doRepaint)
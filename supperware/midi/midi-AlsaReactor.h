@@ -0,0 +1,529 @@
+/*
+ * MIDI drivers
+ * One thread reading many devices through a single ALSA sequencer client (Linux only)
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Receives a source's data, and its watchdog timeouts, from an AlsaReactor.
+        Declared on every platform so that MidiDuplex can implement it. */
+    class ReactorListener : public SysexParser::Listener
+    {
+    public:
+        /** Called on the reactor's thread when a source has sent nothing for
+            its timeout. The watchdog re-arms itself when traffic resumes. */
+        virtual void reactorTimedOut() = 0;
+    };
+};
+
+#if JUCE_LINUX
+#include <alsa/asoundlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstdio>
+
+namespace Midi
+{
+    /** Services any number of head trackers from one thread. All the devices are
+        subscribed to one input port of one sequencer client, so there's a
+        single file descriptor to wait on, in an epoll loop. Each event is
+        routed by its source address, through a lookup table, to that source's
+        SysexParser and listener.
+
+        Watchdogs live on a hashed timing wheel, ticked by the same loop.
+        Traffic only records the current tick; a source is looked at again when
+        its deadline's bucket comes round, and is either moved on or timed out.
+        So a frame costs a store rather than a timer restart, however many
+        devices there are.
+
+        The tables are only locked while events are copied out of the
+        sequencer and the wheel is turned. The copies are parsed, and the
+        listeners called, after the lock is released, so a listener can call
+        back into the reactor (to remove its own source, say) without
+        deadlocking, and a slow one doesn't hold up setTimeout.
+
+        Share one between drivers with juce::SharedResourcePointer<AlsaReactor>.
+        The sequencer client and the thread are only created when the first
+        source is added. */
+    class AlsaReactor : private juce::Thread
+    {
+    public:
+        static constexpr int MaxSources = 128;
+
+        AlsaReactor() :
+            juce::Thread("Head tracker reactor"),
+            seq(nullptr),
+            localPort(-1),
+            epollFd(-1),
+            wakeFd(-1),
+            numSources(0),
+            currentTick(0),
+            pending(nullptr),
+            stagedBytes(InputBufferBytes),
+            numStaged(0),
+            numStagedBytes(0),
+            numTimedOut(0)
+        {
+            for (int16_t& r : routes) r = -1;
+            for (int& w : wheel) w = -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~AlsaReactor()
+        {
+            signalThreadShouldExit();
+            wake();
+            stopThread(TickMilliseconds * 10);
+            if (epollFd >= 0) ::close(epollFd);
+            if (wakeFd >= 0) ::close(wakeFd);
+            if (seq) snd_seq_close(seq);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Subscribes to a device, and returns a handle for removeSource(), or -1.
+            The port is found from its JUCE identifier if possible (JUCE names
+            ALSA ports "client-port"), otherwise by name. The watchdog starts
+            disarmed. */
+        int addSource(const juce::String& identifier, const juce::String& portName, ReactorListener* listener)
+        {
+            // the parser is reset, so wait for any dispatch in progress
+            const juce::ScopedLock dl(dispatchLock);
+            const juce::ScopedLock sl(lock);
+            if (!open())
+            {
+                return -1;
+            }
+
+            int client, port;
+            if (!parseIdentifier(identifier, client, port) &&
+                !AlsaSeqInput::findPort(seq, portName, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, client, port))
+            {
+                return -1;
+            }
+
+            int index = 0;
+            while ((index < MaxSources) && sources[index].isActive)
+            {
+                ++index;
+            }
+            if ((index == MaxSources) || (snd_seq_connect_from(seq, localPort, client, port) < 0))
+            {
+                return -1;
+            }
+
+            Source& s = sources[index];
+            s.client = client;
+            s.port = port;
+            s.listener = listener;
+            s.parser.reset();
+            s.timeoutTicks = 0;
+            s.lastTrafficTick = currentTick;
+            s.isActive = true;
+            setRoute(client, port, static_cast<int16_t>(index));
+            ++numSources;
+            wake();
+            return index;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sets a source's watchdog timeout; 0 disarms it. The first deadline is
+            extended by graceMilliseconds, to give the data time to start. */
+        void setTimeout(const int handle, const int timeoutMilliseconds, const int graceMilliseconds)
+        {
+            const juce::ScopedLock sl(lock);
+            if ((handle < 0) || (handle >= MaxSources) || !sources[handle].isActive)
+            {
+                return;
+            }
+            Source& s = sources[handle];
+            s.timeoutTicks = (timeoutMilliseconds + TickMilliseconds - 1) / TickMilliseconds;
+            s.lastTrafficTick = currentTick + static_cast<uint64_t>(graceMilliseconds / TickMilliseconds);
+            if (!s.isArmed && s.timeoutTicks)
+            {
+                arm(handle);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Unsubscribes. Once this returns, the listener won't be called again:
+            if it's being called on the reactor thread, this waits for that. */
+        void removeSource(const int handle)
+        {
+            {
+                const juce::ScopedLock sl(lock);
+                if ((handle < 0) || (handle >= MaxSources) || !sources[handle].isActive)
+                {
+                    return;
+                }
+                Source& s = sources[handle];
+                s.isActive = false;
+                s.listener = nullptr;
+                setRoute(s.client, s.port, -1);
+                snd_seq_disconnect_from(seq, localPort, s.client, s.port);
+                --numSources;
+            }
+            const juce::ScopedLock dl(dispatchLock);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int TickMilliseconds = 10;
+        static constexpr int WheelSlots = 256;
+        static constexpr int MaxEvents = 8;
+        static constexpr int MaxDescriptors = 4;
+        static constexpr int RoutedClients = 192; // SND_SEQ_MAX_CLIENTS
+        static constexpr int RoutedPorts = 16;
+        static constexpr size_t InputBufferBytes = 65536;
+        static constexpr int MaxStaged = 256;
+
+        /** A subscribed device, and its place on the timing wheel. */
+        struct Source : public SysexParser::Listener
+        {
+            Source() :
+                parser(this),
+                listener(nullptr),
+                client(-1), port(-1),
+                timeoutTicks(0), nextInBucket(-1),
+                lastTrafficTick(0),
+                isActive(false), isArmed(false)
+            {}
+
+            void sysexReceived(const uint8_t* data, const size_t numBytes) override
+            {
+                ReactorListener* const l = listener;
+                if (l) l->sysexReceived(data, numBytes);
+            }
+
+            SysexParser parser; // only used while dispatchLock is held
+            std::atomic<ReactorListener*> listener;
+            int client, port;
+            int timeoutTicks, nextInBucket;
+            uint64_t lastTrafficTick;
+            bool isActive, isArmed;
+        };
+
+        /** A sysex event, copied out of the sequencer, to be parsed once the
+            lock has been released; or a source that has timed out. Either is
+            dropped if its source's listener has changed since. */
+        struct Staged
+        {
+            int index;
+            ReactorListener* listener;
+            size_t offset, numBytes;
+        };
+
+        juce::CriticalSection lock, dispatchLock; // dispatchLock first, if both are taken
+        snd_seq_t* seq;
+        int localPort, epollFd, wakeFd;
+        std::atomic<int> numSources; // changed under lock, but read without it before sleeping
+        Source sources[MaxSources];
+        int16_t routes[RoutedClients * RoutedPorts];
+        int wheel[WheelSlots];
+        uint64_t currentTick;
+        // only touched by the reactor thread, like the staging area below
+        snd_seq_event_t* pending; // read, but not staged yet for lack of room
+        std::vector<uint8_t> stagedBytes;
+        Staged staged[MaxStaged];
+        int numStaged;
+        size_t numStagedBytes;
+        Staged timedOut[MaxSources];
+        int numTimedOut;
+
+        // ------------------------------------------------------------------------
+
+        static bool parseIdentifier(const juce::String& identifier, int& client, int& port)
+        {
+            char trailing;
+            return sscanf(identifier.toRawUTF8(), "%d-%d%c", &client, &port, &trailing) == 2;
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool open()
+        {
+            if (seq)
+            {
+                return true;
+            }
+            if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+            {
+                seq = nullptr;
+                return false;
+            }
+            snd_seq_set_client_name(seq, "Head Tracker reactor");
+            snd_seq_set_input_buffer_size(seq, InputBufferBytes);
+            localPort = snd_seq_create_simple_port(seq, "in",
+                SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT, SND_SEQ_PORT_TYPE_APPLICATION);
+            epollFd = epoll_create1(0);
+            wakeFd = eventfd(0, EFD_NONBLOCK);
+            if ((localPort < 0) || (epollFd < 0) || (wakeFd < 0))
+            {
+                if (epollFd >= 0) ::close(epollFd);
+                if (wakeFd >= 0) ::close(wakeFd);
+                epollFd = wakeFd = -1;
+                snd_seq_close(seq);
+                seq = nullptr;
+                return false;
+            }
+
+            struct pollfd fds[MaxDescriptors];
+            int numFds = snd_seq_poll_descriptors_count(seq, POLLIN);
+            if (numFds > MaxDescriptors) numFds = MaxDescriptors;
+            snd_seq_poll_descriptors(seq, fds, static_cast<unsigned int>(numFds), POLLIN);
+            for (int i = 0; i < numFds; ++i)
+            {
+                watch(fds[i].fd);
+            }
+            watch(wakeFd);
+            startThread();
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void watch(const int fd)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void wake()
+        {
+            if (wakeFd >= 0)
+            {
+                const uint64_t one = 1;
+                juce::ignoreUnused(::write(wakeFd, &one, sizeof(one)));
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void setRoute(const int client, const int port, const int16_t index)
+        {
+            if ((client >= 0) && (client < RoutedClients) && (port >= 0) && (port < RoutedPorts))
+            {
+                routes[client * RoutedPorts + port] = index;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        int findRoute(const int client, const int port) const
+        {
+            if ((client < RoutedClients) && (port < RoutedPorts))
+            {
+                return routes[client * RoutedPorts + port];
+            }
+            // unusually high port numbers aren't in the table
+            for (int i = 0; i < MaxSources; ++i)
+            {
+                if (sources[i].isActive && (sources[i].client == client) && (sources[i].port == port))
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            struct epoll_event events[MaxEvents];
+            double nextTickMs = juce::Time::getMillisecondCounterHiRes() + TickMilliseconds;
+            while (!threadShouldExit())
+            {
+                // with nothing to watch over, sleep until a source is added
+                int timeout = -1;
+                if (numSources)
+                {
+                    const double untilTick = nextTickMs - juce::Time::getMillisecondCounterHiRes();
+                    timeout = (untilTick > 0.0) ? static_cast<int>(ceil(untilTick)) : 0;
+                }
+                const int numEvents = epoll_wait(epollFd, events, MaxEvents, timeout);
+
+                bool hasInput = false;
+                for (int i = 0; i < numEvents; ++i)
+                {
+                    if (events[i].data.fd == wakeFd)
+                    {
+                        uint64_t count;
+                        juce::ignoreUnused(::read(wakeFd, &count, sizeof(count)));
+                    }
+                    else
+                    {
+                        hasInput = true;
+                    }
+                }
+
+                const juce::ScopedLock dl(dispatchLock);
+                bool isMore = hasInput;
+                do
+                {
+                    {
+                        const juce::ScopedLock sl(lock);
+                        isMore = isMore && readEvents();
+                        const double nowMs = juce::Time::getMillisecondCounterHiRes();
+                        if (!numSources)
+                        {
+                            nextTickMs = nowMs + TickMilliseconds;
+                        }
+                        while (nowMs >= nextTickMs)
+                        {
+                            advanceWheel();
+                            nextTickMs += TickMilliseconds;
+                        }
+                    }
+                    dispatch();
+                } while (isMore);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Copies the waiting sysex events into the staging area, noting each
+            source's traffic. Returns true if it stopped because the staging
+            area was full: the event that didn't fit is kept (its data stays
+            valid until the sequencer is read again) and staged next time. */
+        bool readEvents()
+        {
+            snd_seq_event_t* event = pending;
+            pending = nullptr;
+            while (event || (snd_seq_event_input(seq, &event) >= 0))
+            {
+                if (event && (event->type == SND_SEQ_EVENT_SYSEX))
+                {
+                    const size_t numBytes = static_cast<size_t>(event->data.ext.len);
+                    if ((numStaged == MaxStaged) || (numStagedBytes + numBytes > stagedBytes.size()))
+                    {
+                        if (numStaged > 0)
+                        {
+                            pending = event;
+                            return true;
+                        }
+                    }
+                    else
+                    {
+                        stage(event, numBytes);
+                    }
+                }
+                event = nullptr;
+            }
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void stage(const snd_seq_event_t* event, const size_t numBytes)
+        {
+            const int index = findRoute(event->source.client, event->source.port);
+            if (index < 0)
+            {
+                return;
+            }
+            Source& s = sources[index];
+            s.lastTrafficTick = currentTick;
+            if (!s.isArmed && s.timeoutTicks)
+            {
+                arm(index);
+            }
+            memcpy(stagedBytes.data() + numStagedBytes, event->data.ext.ptr, numBytes);
+            staged[numStaged++] = { index, s.listener, numStagedBytes, numBytes };
+            numStagedBytes += numBytes;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Parses the staged events and reports the timeouts, without the lock.
+            A source removed since it was staged is skipped; one can't be
+            added meanwhile, as addSource needs dispatchLock. */
+        void dispatch()
+        {
+            for (int i = 0; i < numStaged; ++i)
+            {
+                const Staged& e = staged[i];
+                Source& s = sources[e.index];
+                if (s.listener == e.listener)
+                {
+                    s.parser.parse(stagedBytes.data() + e.offset, e.numBytes);
+                }
+            }
+            numStaged = 0;
+            numStagedBytes = 0;
+
+            for (int i = 0; i < numTimedOut; ++i)
+            {
+                const Staged& t = timedOut[i];
+                if (sources[t.index].listener == t.listener)
+                {
+                    t.listener->reactorTimedOut();
+                }
+            }
+            numTimedOut = 0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void arm(const int index)
+        {
+            insert(index, sources[index].lastTrafficTick + static_cast<uint64_t>(sources[index].timeoutTicks));
+        }
+
+        // ------------------------------------------------------------------------
+
+        void insert(const int index, const uint64_t deadlineTick)
+        {
+            // deadlines beyond the wheel's reach wait in the furthest bucket, and are looked at again
+            uint64_t delta = deadlineTick - currentTick;
+            if (delta >= WheelSlots) delta = WheelSlots - 1;
+            if (delta == 0) delta = 1;
+            const int bucket = static_cast<int>((currentTick + delta) % WheelSlots);
+            sources[index].nextInBucket = wheel[bucket];
+            sources[index].isArmed = true;
+            wheel[bucket] = index;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void advanceWheel()
+        {
+            ++currentTick;
+            const int bucket = static_cast<int>(currentTick % WheelSlots);
+            int index = wheel[bucket];
+            wheel[bucket] = -1;
+            while (index >= 0)
+            {
+                Source& s = sources[index];
+                const int next = s.nextInBucket;
+                s.isArmed = false;
+                if (s.isActive && s.timeoutTicks)
+                {
+                    const uint64_t deadline = s.lastTrafficTick + static_cast<uint64_t>(s.timeoutTicks);
+                    if (deadline > currentTick)
+                    {
+                        insert(index, deadline);
+                    }
+                    else if (s.listener && (numTimedOut < MaxSources))
+                    {
+                        timedOut[numTimedOut++] = { index, s.listener, 0, 0 };
+                    }
+                }
+                index = next;
+            }
+        }
+    };
+};
+#endif
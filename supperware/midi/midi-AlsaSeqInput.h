@@ -0,0 +1,170 @@
+/*
+ * MIDI drivers
+ * Direct ALSA sequencer input, bypassing juce::MidiInput (Linux only)
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_LINUX
+#include <alsa/asoundlib.h>
+#include <poll.h>
+
+namespace Midi
+{
+    /** Reads a device through its own ALSA sequencer client, on a dedicated
+        thread that sleeps in poll() until data arrives. Sysex bytes are handed
+        from the sequencer's event buffer to a SysexParser without building a
+        juce::MidiMessage, so there's no allocation and no extra thread hop
+        between the device and the listener. The thread does nothing but
+        decode and publish, and can be given real-time priority with
+        setScheduling(). */
+    class AlsaSeqInput : public IngestionThread
+    {
+    public:
+        AlsaSeqInput(SysexParser::Listener* listener) :
+            IngestionThread("Head tracker ALSA input"),
+            parser(listener),
+            seq(nullptr),
+            localPort(-1)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        ~AlsaSeqInput()
+        {
+            close();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Finds the sequencer port with this name (as listed by
+            juce::MidiInput::getAvailableDevices), subscribes to it, and starts
+            reading. Returns false if the port can't be found or opened. */
+        bool open(const juce::String& portName)
+        {
+            close();
+            if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+            {
+                seq = nullptr;
+                return false;
+            }
+            snd_seq_set_client_name(seq, "Head Tracker input");
+            snd_seq_set_input_buffer_size(seq, InputBufferBytes);
+
+            int sourceClient, sourcePort;
+            localPort = snd_seq_create_simple_port(seq, "in",
+                SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT, SND_SEQ_PORT_TYPE_APPLICATION);
+            if ((localPort < 0) ||
+                !findPort(seq, portName, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, sourceClient, sourcePort) ||
+                (snd_seq_connect_from(seq, localPort, sourceClient, sourcePort) < 0))
+            {
+                close();
+                return false;
+            }
+
+            parser.reset();
+            startThread();
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void close()
+        {
+            stopThread(PollMilliseconds * 4);
+            if (seq)
+            {
+                snd_seq_close(seq);
+                seq = nullptr;
+            }
+            localPort = -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isOpen() const
+        {
+            return seq != nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Looks up a sequencer port by name, as JUCE names it, and returns
+            its address. Only ports with all the given capabilities match. */
+        static bool findPort(snd_seq_t* s, const juce::String& portName, const unsigned int capabilities,
+            int& client, int& port)
+        {
+            bool isFound = false;
+            snd_seq_client_info_t* clientInfo;
+            snd_seq_port_info_t* portInfo;
+            snd_seq_client_info_malloc(&clientInfo);
+            snd_seq_port_info_malloc(&portInfo);
+
+            snd_seq_client_info_set_client(clientInfo, -1);
+            while (!isFound && (snd_seq_query_next_client(s, clientInfo) >= 0))
+            {
+                const int c = snd_seq_client_info_get_client(clientInfo);
+                snd_seq_port_info_set_client(portInfo, c);
+                snd_seq_port_info_set_port(portInfo, -1);
+                while (!isFound && (snd_seq_query_next_port(s, portInfo) >= 0))
+                {
+                    if (((snd_seq_port_info_get_capability(portInfo) & capabilities) == capabilities) &&
+                        (portName == juce::String(snd_seq_port_info_get_name(portInfo))))
+                    {
+                        client = c;
+                        port = snd_seq_port_info_get_port(portInfo);
+                        isFound = true;
+                    }
+                }
+            }
+
+            snd_seq_port_info_free(portInfo);
+            snd_seq_client_info_free(clientInfo);
+            return isFound;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int PollMilliseconds = 100;
+        static constexpr int MaxDescriptors = 4;
+        static constexpr size_t InputBufferBytes = 16384;
+
+        SysexParser parser;
+        snd_seq_t* seq;
+        int localPort;
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            applyScheduling();
+            struct pollfd fds[MaxDescriptors];
+            int numFds = snd_seq_poll_descriptors_count(seq, POLLIN);
+            if (numFds > MaxDescriptors) numFds = MaxDescriptors;
+            snd_seq_poll_descriptors(seq, fds, static_cast<unsigned int>(numFds), POLLIN);
+
+            while (!threadShouldExit())
+            {
+                // the timeout is only there so that the thread can be stopped
+                if (poll(fds, static_cast<nfds_t>(numFds), PollMilliseconds) <= 0)
+                {
+                    continue;
+                }
+
+                snd_seq_event_t* event = nullptr;
+                while (snd_seq_event_input(seq, &event) >= 0)
+                {
+                    if (event && (event->type == SND_SEQ_EVENT_SYSEX))
+                    {
+                        parser.parse(static_cast<const uint8_t*>(event->data.ext.ptr),
+                            static_cast<size_t>(event->data.ext.len));
+                    }
+                }
+            }
+            clearScheduling();
+        }
+    };
+};
+#endif
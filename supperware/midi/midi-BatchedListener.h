@@ -0,0 +1,180 @@
+/*
+ * MIDI drivers
+ * Collects tracker frames, and hands them over in batches at the consumer's pace
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** For consumers that work at their own pace, such as an audio processor
+        or a network relay, and would rather have every frame that arrived
+        since they last looked, in one go, than a callback for each. Frames
+        are timestamped (see TrackerDriver::timestampFrame) and pushed into a
+        FrameQueue on the MIDI thread; nothing else happens there.
+
+        Either pull() them whenever it suits (it doesn't lock or allocate, so
+        the audio callback can do this each block), or give a Listener and an
+        interval, and this object's own thread hands over a batch at that
+        cadence. Every frame is kept, in order, so the consumer can
+        interpolate between them, unless the queue overflows: then the oldest
+        are dropped. Only orientation events are subscribed to. */
+    class BatchedListener : private TrackerDriver::Listener, private juce::Thread
+    {
+    public:
+        class Listener
+        {
+        public:
+            virtual ~Listener() {};
+
+            /** Every frame since the last batch, oldest first. */
+            virtual void trackerFrames(const OrientationFrame* /*frames*/, size_t /*numFrames*/) {}
+        };
+
+        /** For pulling: the capacity should hold all the frames that can
+            arrive between two pulls. */
+        BatchedListener(TrackerDriver& trackerDriver, const size_t capacity = DefaultCapacity) :
+            juce::Thread("Head tracker batch delivery"),
+            td(trackerDriver),
+            l(nullptr),
+            intervalMs(0.0),
+            queue(capacity, OverflowPolicy::KeepNewest)
+        {
+            td.addListener(this, TrackerDriver::OrientationEvents);
+        }
+
+        /** For delivery every intervalMilliseconds, on this object's thread. */
+        BatchedListener(TrackerDriver& trackerDriver, Listener* listener, const double intervalMilliseconds,
+            const size_t capacity = DefaultCapacity) :
+            juce::Thread("Head tracker batch delivery"),
+            td(trackerDriver),
+            l(listener),
+            intervalMs(intervalMilliseconds),
+            queue(capacity, OverflowPolicy::KeepNewest),
+            batch(capacity)
+        {
+            startThread();
+            td.addListener(this, TrackerDriver::OrientationEvents);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~BatchedListener()
+        {
+            td.removeListener(this);
+            stopThread(static_cast<int>(intervalMs) + WaitMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Copies up to maxFrames of the waiting frames into frames, oldest
+            first, and returns how many. Only from one thread at a time, and
+            not when a Listener is being called. */
+        size_t pull(OrientationFrame* frames, const size_t maxFrames)
+        {
+            return queue.popBatch(frames, maxFrames);
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getCapacity() const
+        {
+            return queue.getCapacity();
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getMaxQueueDepth() const
+        {
+            return queue.getMaxDepth();
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getDroppedFrames() const
+        {
+            return queue.getDroppedFrames();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr size_t DefaultCapacity = 16;
+        static constexpr int WaitMilliseconds = 100;
+
+        TrackerDriver& td;
+        Listener* l;
+        const double intervalMs;
+        FrameQueue queue;
+        std::vector<OrientationFrame> batch;
+
+        // ------------------------------------------------------------------------
+
+        void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::YPR;
+            f.values[0] = yawRadian;
+            f.values[1] = pitchRadian;
+            f.values[2] = rollRadian;
+            enqueue(f);
+        }
+
+        void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::Quaternion;
+            f.values[0] = qw;
+            f.values[1] = qx;
+            f.values[2] = qy;
+            f.values[3] = qz;
+            enqueue(f);
+        }
+
+        void trackerOrientationM(float* matrix) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::Matrix;
+            memcpy(f.values, matrix, sizeof(f.values));
+            enqueue(f);
+        }
+
+        juce::String getListenerName() const override
+        {
+            return "Batch queue";
+        }
+
+        // ------------------------------------------------------------------------
+
+        void enqueue(OrientationFrame& f)
+        {
+            td.timestampFrame(f);
+            queue.push(f);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            // deadlines are counted from the start, so the cadence doesn't drift
+            double nextMs = juce::Time::getMillisecondCounterHiRes() + intervalMs;
+            while (!threadShouldExit())
+            {
+                const double now = juce::Time::getMillisecondCounterHiRes();
+                if (now < nextMs)
+                {
+                    wait(juce::jmax(1, static_cast<int>(nextMs - now)));
+                    continue;
+                }
+                nextMs = (now - nextMs > intervalMs) ? now + intervalMs : nextMs + intervalMs;
+
+                const size_t n = queue.popBatch(batch.data(), batch.size());
+                if (n > 0)
+                {
+                    l->trackerFrames(batch.data(), n);
+                }
+            }
+        }
+    };
+};
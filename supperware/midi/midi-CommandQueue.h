@@ -0,0 +1,135 @@
+/*
+ * MIDI drivers
+ * Bounded lock-free queue of head tracker commands, from any number of threads
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** A command for the head tracker, small enough to copy around freely. The
+        sysex isn't formatted until it's sent, on the sender thread. */
+    struct TrackerCommand
+    {
+        enum class Type : uint8_t { TurnOn, TurnOff, Zero, Chirality, TravelMode, Compass, CalibrateCompass, Readback, Probe, Restore };
+
+        Type type;
+        uint8_t arg0, arg1;
+
+        /** Commands with the same key overwrite each other's effect, so only
+            the last of a run needs sending. Turning on and off share a key. */
+        uint8_t getCoalescingKey() const
+        {
+            return (type == Type::TurnOff) ? static_cast<uint8_t>(Type::TurnOn) : static_cast<uint8_t>(type);
+        }
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Bounded multiple-producer queue after Dmitry Vyukov's design: every cell
+        carries a sequence number, so producers only contend on one
+        compare-and-swap, and nobody ever waits on a lock. push() fails
+        rather than blocking when the queue is full. Only one thread may pop. */
+    class CommandQueue
+    {
+    public:
+        /** The capacity is rounded up to a power of two. */
+        CommandQueue(const size_t minimumCapacity) :
+            enqueuePosition(0),
+            dequeuePosition(0),
+            dropped(0)
+        {
+            size_t capacity = 2;
+            while (capacity < minimumCapacity)
+            {
+                capacity <<= 1;
+            }
+            mask = capacity - 1;
+            cells.reset(new Cell[capacity]);
+            for (size_t i = 0; i < capacity; ++i)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getCapacity() const
+        {
+            return mask + 1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getDroppedCommands() const
+        {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Safe from any thread, including real-time ones. */
+        bool push(const TrackerCommand& command)
+        {
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[position & mask];
+                const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0)
+                {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.command = command;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Consumer only. */
+        bool pop(TrackerCommand& command)
+        {
+            const size_t position = dequeuePosition.load(std::memory_order_relaxed);
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence != position + 1)
+            {
+                return false;
+            }
+            command = cell.command;
+            cell.sequence.store(position + mask + 1, std::memory_order_release);
+            dequeuePosition.store(position + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            TrackerCommand command;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueuePosition;
+        alignas(64) std::atomic<size_t> dequeuePosition;
+        std::atomic<uint64_t> dropped;
+    };
+};
@@ -0,0 +1,171 @@
+/*
+ * MIDI drivers
+ * Notification of MIDI devices arriving and leaving
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_LINUX
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#endif
+
+namespace Midi
+{
+    /** Tells its listeners whenever MIDI ports appear or disappear, so that the
+        device list only needs enumerating when something has changed.
+        On Linux this listens for ALSA sequencer announcements on its own
+        thread. Elsewhere, or if the sequencer can't be opened, isWatching()
+        returns false and the owners should carry on polling.
+
+        One is enough for the whole process: hold it through a
+        SharedDeviceWatcher, so that however many devices are being driven,
+        there's only one sequencer client and one thread. */
+    class DeviceWatcher
+#if JUCE_LINUX
+        : private juce::Thread
+#endif
+    {
+    public:
+        class Listener
+        {
+        public:
+            virtual ~Listener() {};
+
+            /** Called from the watcher's own thread, with the listener list
+                locked: keep it short, and don't add or remove listeners here. */
+            virtual void midiDevicesChanged() = 0;
+        };
+
+        // ------------------------------------------------------------------------
+
+        void addListener(Listener* listener)
+        {
+            const juce::ScopedLock sl(listenerLock);
+            listeners.addIfNotAlreadyThere(listener);
+        }
+
+        /** Once this returns, the listener won't be called again. */
+        void removeListener(Listener* listener)
+        {
+            const juce::ScopedLock sl(listenerLock);
+            listeners.removeFirstMatchingValue(listener);
+        }
+
+        // ------------------------------------------------------------------------
+
+#if JUCE_LINUX
+        DeviceWatcher() :
+            juce::Thread("MIDI device watcher"),
+            seq(nullptr)
+        {
+            if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+            {
+                seq = nullptr;
+                return;
+            }
+            snd_seq_set_client_name(seq, "Head Tracker device watcher");
+            const int port = snd_seq_create_simple_port(seq, "announce",
+                SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT, SND_SEQ_PORT_TYPE_APPLICATION);
+            if ((port < 0) || (snd_seq_connect_from(seq, port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0))
+            {
+                snd_seq_close(seq);
+                seq = nullptr;
+                return;
+            }
+            startThread();
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~DeviceWatcher()
+        {
+            stopThread(PollMilliseconds * 4);
+            if (seq)
+            {
+                snd_seq_close(seq);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isWatching() const
+        {
+            return seq != nullptr;
+        }
+#else
+        DeviceWatcher() {}
+
+        bool isWatching() const
+        {
+            return false;
+        }
+#endif
+
+        // ------------------------------------------------------------------------
+
+    private:
+        juce::CriticalSection listenerLock;
+        juce::Array<Listener*> listeners;
+#if JUCE_LINUX
+        static constexpr int PollMilliseconds = 100;
+        static constexpr int MaxDescriptors = 4;
+        snd_seq_t* seq;
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            struct pollfd fds[MaxDescriptors];
+            int numFds = snd_seq_poll_descriptors_count(seq, POLLIN);
+            if (numFds > MaxDescriptors) numFds = MaxDescriptors;
+            snd_seq_poll_descriptors(seq, fds, static_cast<unsigned int>(numFds), POLLIN);
+
+            while (!threadShouldExit())
+            {
+                // the timeout is only there so that the thread can be stopped
+                if (poll(fds, static_cast<nfds_t>(numFds), PollMilliseconds) <= 0)
+                {
+                    continue;
+                }
+
+                bool hasChanged = false;
+                snd_seq_event_t* event = nullptr;
+                while (snd_seq_event_input(seq, &event) >= 0)
+                {
+                    if (event)
+                    {
+                        switch (event->type)
+                        {
+                        case SND_SEQ_EVENT_CLIENT_START:
+                        case SND_SEQ_EVENT_CLIENT_EXIT:
+                        case SND_SEQ_EVENT_PORT_START:
+                        case SND_SEQ_EVENT_PORT_EXIT:
+                        case SND_SEQ_EVENT_PORT_CHANGE:
+                            hasChanged = true;
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+                }
+                if (hasChanged)
+                {
+                    const juce::ScopedLock sl(listenerLock);
+                    for (Listener* l : listeners)
+                    {
+                        l->midiDevicesChanged();
+                    }
+                }
+            }
+        }
+#endif
+
+        JUCE_DECLARE_NON_COPYABLE(DeviceWatcher)
+    };
+
+    // ----------------------------------------------------------------------------
+
+    using SharedDeviceWatcher = juce::SharedResourcePointer<DeviceWatcher>;
+};
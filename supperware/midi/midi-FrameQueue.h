@@ -0,0 +1,275 @@
+/*
+ * MIDI drivers
+ * Bounded lock-free queue of orientation frames, from one producer to one consumer
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** One orientation frame from the head tracker, in whichever form it was sent. */
+    struct OrientationFrame
+    {
+        enum class Type : uint8_t { YPR, Quaternion, Matrix };
+
+        Type type;
+        /** yaw, pitch, roll; or qw, qx, qy, qz; or nine matrix entries. */
+        float values[9];
+        /** Arrival time, from juce::Time::getMillisecondCounterHiRes(). */
+        double arrivalMs;
+        /** Arrival time on JACK's frame clock, or -1 unless the Jack input
+            backend is in use (see MidiDuplex::getMessageSampleTime). */
+        int64_t sampleTime;
+        /** Arrival time with the jitter filtered out (see FrameClock), on the
+            same clock as arrivalMs. */
+        double smoothedMs;
+        /** The smoothed arrival time on the audio sample clock, or -1 (see
+            TrackerDriver::getAudioClock). */
+        double audioSample;
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** What push() does when the queue is full. Block makes the producer
+        wait, so it's only for producers that can: never the MIDI thread. */
+    enum class OverflowPolicy { KeepNewest, KeepOldest, Block };
+
+    // ----------------------------------------------------------------------------
+
+    /** Fixed-capacity ring buffer of OrientationFrames between one producer
+        thread and one consumer thread. Neither side takes a lock, and nothing
+        is allocated after construction.
+
+        Each slot is a sequence lock: its sequence number is odd while the
+        producer writes it, and the frame is held as atomic words, so that a
+        read which overlaps a write is well defined, and is detected. With
+        KeepNewest the producer never waits for the consumer, and simply
+        writes over the oldest frames; the consumer notices what it missed
+        and counts it as dropped, so the drop counter is only brought up to
+        date when the consumer next runs. With KeepOldest the producer drops
+        the new frame instead, and with Block it sleeps until there's room. */
+    class FrameQueue
+    {
+    public:
+        FrameQueue(const size_t capacity, const OverflowPolicy overflowPolicy) :
+            size(capacity > 0 ? capacity : 1),
+            slots(new Slot[size]),
+            policy(overflowPolicy),
+            head(0),
+            tail(0),
+            dropped(0),
+            maxDepth(0),
+            isProducerWaiting(false),
+            isClosed(false)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** Producer side. Returns true if the consumer had taken every frame
+            before this one, which is when it may have gone to sleep and need
+            waking. The tail is read again after the frame is published, so a
+            consumer that emptied the queue meanwhile isn't missed: either it
+            sees the new frame, or this sees its tail. */
+        bool push(const OrientationFrame& frame)
+        {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            if ((policy != OverflowPolicy::KeepNewest) && (h - tail.load() >= size))
+            {
+                if ((policy == OverflowPolicy::KeepOldest) || !waitForRoom(h))
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+
+            write(slots[static_cast<size_t>(h % size)], h, frame);
+            head.store(h + 1); // sequentially consistent, like the consumer's tail update and head load
+
+            const uint64_t t = tail.load();
+            const uint64_t depth = std::min<uint64_t>(h + 1 - t, size);
+            if (depth > maxDepth.load(std::memory_order_relaxed))
+            {
+                maxDepth.store(depth, std::memory_order_relaxed);
+            }
+            return t >= h;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Consumer side. Returns false if the queue is empty. */
+        bool pop(OrientationFrame& frame)
+        {
+            // only the consumer moves the tail
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            bool isFound = false;
+            for (;;)
+            {
+                const uint64_t h = head.load();
+                if (t == h)
+                {
+                    break;
+                }
+                if (h - t > size)
+                {
+                    // written over while we weren't looking
+                    dropped.fetch_add(h - size - t, std::memory_order_relaxed);
+                    t = h - size;
+                }
+                if (read(slots[static_cast<size_t>(t % size)], t, frame))
+                {
+                    ++t;
+                    isFound = true;
+                    break;
+                }
+                // written over while we were reading it
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                ++t;
+            }
+
+            tail.store(t);
+            if ((policy == OverflowPolicy::Block) && isProducerWaiting.load())
+            {
+                roomFree.signal();
+            }
+            return isFound;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Consumer side: copies up to maxFrames of the oldest frames into dest,
+            in order, and returns how many. */
+        size_t popBatch(OrientationFrame* dest, const size_t maxFrames)
+        {
+            size_t n = 0;
+            while ((n < maxFrames) && pop(dest[n]))
+            {
+                ++n;
+            }
+            return n;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Releases a producer waiting under OverflowPolicy::Block. */
+        void close()
+        {
+            isClosed = true;
+            roomFree.signal();
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getCapacity() const
+        {
+            return static_cast<size_t>(size);
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getDepth() const
+        {
+            const uint64_t t = tail.load();
+            return static_cast<size_t>(std::min<uint64_t>(head.load() - t, size));
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getMaxDepth() const
+        {
+            return static_cast<size_t>(maxDepth.load(std::memory_order_relaxed));
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getDroppedFrames() const
+        {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr size_t NumWords = (sizeof(OrientationFrame) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        static_assert(std::is_trivially_copyable<OrientationFrame>::value, "frames are copied as words");
+
+        /** Holds the frame at position p once its sequence number is 2p + 2. */
+        struct Slot
+        {
+            Slot() :
+                sequence(0)
+            {}
+
+            std::atomic<uint64_t> sequence;
+            std::atomic<uint64_t> words[NumWords];
+        };
+
+        const uint64_t size;
+        std::unique_ptr<Slot[]> slots;
+        const OverflowPolicy policy;
+        std::atomic<uint64_t> head, tail, dropped, maxDepth;
+        std::atomic<bool> isProducerWaiting, isClosed;
+        juce::WaitableEvent roomFree;
+
+        // ------------------------------------------------------------------------
+
+        static void write(Slot& slot, const uint64_t position, const OrientationFrame& frame)
+        {
+            uint64_t words[NumWords] = {};
+            memcpy(words, &frame, sizeof(frame));
+            slot.sequence.store(position * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < NumWords; ++i)
+            {
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            }
+            slot.sequence.store(position * 2 + 2, std::memory_order_release);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** False if the slot no longer holds the frame at this position. */
+        static bool read(const Slot& slot, const uint64_t position, OrientationFrame& frame)
+        {
+            const uint64_t expected = position * 2 + 2;
+            if (slot.sequence.load(std::memory_order_acquire) != expected)
+            {
+                return false;
+            }
+            uint64_t words[NumWords];
+            for (size_t i = 0; i < NumWords; ++i)
+            {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected)
+            {
+                return false;
+            }
+            memcpy(&frame, words, sizeof(frame));
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sleeps until the consumer has made room for position h, or the
+            queue is closed. The flag is set before the tail is read, and the
+            consumer moves the tail before it reads the flag, so one of them
+            sees the other. */
+        bool waitForRoom(const uint64_t h)
+        {
+            isProducerWaiting = true;
+            while (h - tail.load() >= size)
+            {
+                if (isClosed.load())
+                {
+                    isProducerWaiting = false;
+                    return false;
+                }
+                roomFree.wait();
+            }
+            isProducerWaiting = false;
+            return true;
+        }
+    };
+};
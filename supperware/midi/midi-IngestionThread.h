@@ -0,0 +1,107 @@
+/*
+ * MIDI drivers
+ * Input thread with optional real-time scheduling and CPU affinity (Linux only)
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_LINUX
+#include <pthread.h>
+#include <sched.h>
+
+namespace Midi
+{
+    enum class ThreadMode { NotRunning, Normal, Realtime };
+
+    /** Base for threads that read tracker data. It can ask for SCHED_FIFO
+        scheduling and pin itself to one CPU core, so frames still arrive on
+        time when the GUI or network is busy. If the process isn't allowed
+        real-time scheduling (no CAP_SYS_NICE or rtprio limit), it carries on
+        at normal priority; getThreadMode() says which it got. */
+    class IngestionThread : public juce::Thread
+    {
+    public:
+        IngestionThread(const juce::String& threadName) :
+            juce::Thread(threadName),
+            fifoPriority(0),
+            cpuCore(-1),
+            threadMode(ThreadMode::NotRunning),
+            isPinned(false)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** A fifoPriority of 0 means ordinary scheduling; 1 to 99 asks for
+            SCHED_FIFO at that priority. A cpuCore of -1 lets the thread run
+            anywhere. Takes effect the next time the thread starts. */
+        void setScheduling(const int newFifoPriority, const int newCpuCore)
+        {
+            fifoPriority = newFifoPriority;
+            cpuCore = newCpuCore;
+        }
+
+        // ------------------------------------------------------------------------
+
+        ThreadMode getThreadMode() const
+        {
+            return threadMode;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** True if the thread is pinned to the requested CPU core. */
+        bool isPinnedToCore() const
+        {
+            return isPinned;
+        }
+
+        // ------------------------------------------------------------------------
+
+    protected:
+        /** Call this at the start of run(). */
+        void applyScheduling()
+        {
+            ThreadMode mode = ThreadMode::Normal;
+            if (fifoPriority > 0)
+            {
+                struct sched_param param;
+                param.sched_priority = juce::jlimit(sched_get_priority_min(SCHED_FIFO),
+                    sched_get_priority_max(SCHED_FIFO), fifoPriority);
+                if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+                {
+                    mode = ThreadMode::Realtime;
+                }
+            }
+
+            bool pinned = false;
+            if (cpuCore >= 0)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(cpuCore, &cpus);
+                pinned = (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+            }
+
+            isPinned = pinned;
+            threadMode = mode;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Call this at the end of run(). */
+        void clearScheduling()
+        {
+            threadMode = ThreadMode::NotRunning;
+            isPinned = false;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        int fifoPriority, cpuCore;
+        std::atomic<ThreadMode> threadMode;
+        std::atomic<bool> isPinned;
+    };
+};
+#endif
@@ -0,0 +1,200 @@
+/*
+ * MIDI drivers
+ * JACK MIDI input, with each message stamped by its sample position
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+/* Off by default, because it needs the JACK headers, and linking with libjack.
+   Define SUPPERWARE_USE_JACK=1 in the project's preprocessor definitions to
+   build it. */
+#ifndef SUPPERWARE_USE_JACK
+#define SUPPERWARE_USE_JACK 0
+#endif
+
+#if SUPPERWARE_USE_JACK
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+namespace Midi
+{
+    /** Reads a device through a JACK MIDI input port, inside JACK's process
+        callback. As each event is parsed, getEventTime() gives its position on
+        JACK's frame clock: the cycle's first frame plus the event's offset
+        within the cycle. That's the same clock the audio is processed on, so
+        a frame can be applied at the exact sample it arrived at, without
+        mapping wall-clock timestamps to audio by hand.
+
+        The device has to be visible to JACK: bridged by a2jmidid, or through
+        jackd's own ALSA MIDI driver (-X seq). Ports are matched on their names
+        and aliases, both of which contain the ALSA port name in either case.
+        This works with jackd's dummy driver too, with a SimulatedTracker's
+        virtual port standing in for the hardware. */
+    class JackInput
+    {
+    public:
+        JackInput(SysexParser::Listener* listener) :
+            parser(listener),
+            client(nullptr),
+            inputPort(nullptr),
+            eventTime(-1)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        ~JackInput()
+        {
+            close();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Connects to a running JACK server (it won't start one), finds the
+            MIDI port for this device, and connects it to our input. Returns
+            false if there's no server or no such port. */
+        bool open(const juce::String& portName)
+        {
+            close();
+            jack_status_t status;
+            client = jack_client_open("Head Tracker input", JackNoStartServer, &status);
+            if (!client)
+            {
+                return false;
+            }
+            inputPort = jack_port_register(client, "in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+            parser.reset();
+            if (!inputPort ||
+                (jack_set_process_callback(client, processCallback, this) != 0) ||
+                (jack_activate(client) != 0))
+            {
+                close();
+                return false;
+            }
+
+            const juce::String source = findPort(portName);
+            if (source.isEmpty() ||
+                (jack_connect(client, source.toRawUTF8(), jack_port_name(inputPort)) != 0))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Once this returns, the listener won't be called again. */
+        void close()
+        {
+            if (client)
+            {
+                jack_deactivate(client);
+                jack_client_close(client);
+                client = nullptr;
+            }
+            inputPort = nullptr;
+            eventTime = -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isOpen() const
+        {
+            return client != nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The JACK frame time of the message being passed to the listener, or -1
+            when called from outside a callback. Frame times are 32 bits wide,
+            and wrap round after a day or so, so compare them by subtracting. */
+        int64_t getEventTime() const
+        {
+            return eventTime.load(std::memory_order_relaxed);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The JACK frame time at the start of the current process cycle, or -1
+            if not open. Call this from an audio callback running on JACK: a
+            frame stamped with getEventTime() belongs at
+            (eventTime - cycleStart) samples into the buffer, plus one period
+            if it arrived in the previous cycle. */
+        int64_t getCycleStartTime() const
+        {
+            return client ? static_cast<int64_t>(jack_last_frame_time(client)) : -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        SysexParser parser;
+        jack_client_t* client;
+        jack_port_t* inputPort;
+        std::atomic<int64_t> eventTime;
+
+        // ------------------------------------------------------------------------
+
+        /** Looks for a MIDI output port whose name or alias contains the
+            device's name. jackd's ALSA driver puts hyphens in place of spaces. */
+        juce::String findPort(const juce::String& portName) const
+        {
+            const juce::String hyphenated = portName.replaceCharacter(' ', '-');
+            juce::String found;
+            const char** ports = jack_get_ports(client, nullptr, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput);
+            if (!ports)
+            {
+                return found;
+            }
+
+            const int aliasSize = jack_port_name_size();
+            juce::HeapBlock<char> aliasBuffer(static_cast<size_t>(2 * aliasSize), true);
+            char* aliases[2] = { aliasBuffer.get(), aliasBuffer.get() + aliasSize };
+            for (int i = 0; ports[i] && found.isEmpty(); ++i)
+            {
+                if (juce::String(ports[i]).contains(portName))
+                {
+                    found = ports[i];
+                    continue;
+                }
+                jack_port_t* port = jack_port_by_name(client, ports[i]);
+                const int numAliases = port ? jack_port_get_aliases(port, aliases) : 0;
+                for (int a = 0; (a < numAliases) && found.isEmpty(); ++a)
+                {
+                    const juce::String alias(aliases[a]);
+                    if (alias.contains(portName) || alias.contains(hyphenated))
+                    {
+                        found = ports[i];
+                    }
+                }
+            }
+            jack_free(ports);
+            return found;
+        }
+
+        // ------------------------------------------------------------------------
+
+        static int processCallback(jack_nframes_t numFrames, void* arg)
+        {
+            // JACK's real-time thread: parsing doesn't allocate or lock
+            JackInput* self = static_cast<JackInput*>(arg);
+            void* buffer = jack_port_get_buffer(self->inputPort, numFrames);
+            const jack_nframes_t cycleStart = jack_last_frame_time(self->client);
+            const jack_nframes_t numEvents = jack_midi_get_event_count(buffer);
+            for (jack_nframes_t i = 0; i < numEvents; ++i)
+            {
+                jack_midi_event_t event;
+                if (jack_midi_event_get(&event, buffer, i) == 0)
+                {
+                    self->eventTime.store(static_cast<int64_t>(static_cast<jack_nframes_t>(cycleStart + event.time)),
+                        std::memory_order_relaxed);
+                    self->parser.parse(event.buffer, event.size);
+                }
+            }
+            self->eventTime.store(-1, std::memory_order_relaxed);
+            return 0;
+        }
+    };
+};
+#endif
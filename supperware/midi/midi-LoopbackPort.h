@@ -0,0 +1,31 @@
+/*
+ * MIDI drivers
+ * In-process replacement for a device's MIDI ports
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Something that can stand in for a device's MIDI input and output
+        within the same process, such as a SimulatedTracker. Give one to
+        MidiDuplex::setLoopbackPort(), and the duplex talks to it instead of
+        looking for hardware. */
+    class LoopbackPort
+    {
+    public:
+        virtual ~LoopbackPort() {};
+
+        /** Called on connection. Until closeLoopback() returns, the port sends
+            incoming sysex to the receiver, from any thread. */
+        virtual void openLoopback(SysexParser::Listener* receiver) = 0;
+        virtual void closeLoopback() = 0;
+
+        /** A complete MIDI message from the host, as juce::MidiMessage::getRawData. */
+        virtual void loopbackMessage(const uint8_t* data, const size_t numBytes) = 0;
+
+        /** True if the port is standing in for the device's bootloader. */
+        virtual bool isLoopbackBootloader() const { return false; }
+    };
+};
@@ -0,0 +1,62 @@
+/*
+ * MIDI drivers
+ * Prebuilt outgoing messages, so that sending doesn't allocate
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** A juce::MidiMessage holding more than a few bytes of sysex allocates
+        when it's built, so messages that are sent repeatedly are built once,
+        up front, and looked up by their bytes when they're needed. The head
+        tracker only understands a couple of dozen distinct commands, so a
+        linear search is plenty. */
+    class MessageBank
+    {
+    public:
+        MessageBank() {}
+
+        // ------------------------------------------------------------------------
+
+        /** Builds a message and keeps it. This allocates, so do it before
+            sending starts. Adding the same bytes twice does nothing. */
+        void add(const uint8_t* data, const size_t numBytes)
+        {
+            if (!find(data, numBytes))
+            {
+                messages.push_back(juce::MidiMessage(data, static_cast<int>(numBytes)));
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Returns the prebuilt message with these bytes, or nullptr. This
+            doesn't allocate. */
+        const juce::MidiMessage* find(const uint8_t* data, const size_t numBytes) const
+        {
+            for (const juce::MidiMessage& message : messages)
+            {
+                if ((static_cast<size_t>(message.getRawDataSize()) == numBytes) &&
+                    (memcmp(message.getRawData(), data, numBytes) == 0))
+                {
+                    return &message;
+                }
+            }
+            return nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t size() const
+        {
+            return messages.size();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        std::vector<juce::MidiMessage> messages;
+    };
+};
@@ -11,30 +11,47 @@ namespace Midi
 {
     enum class State { Unavailable, Available, Bootloader, Connected };
     enum class Connection { AsBootloader, AsDevice, AsEither };
+    enum class InputBackend { Juce, AlsaSequencer, AlsaReactor, Jack };
 
-    class MidiDuplex : public juce::MidiInputCallback, protected juce::MultiTimer
+    class MidiDuplex : public juce::MidiInputCallback, protected juce::MultiTimer,
+        private DeviceWatcher::Listener, private ReactorListener
     {
     public:
+        /** MultiTimer IDs used here. Inherited classes may use 2 and above. */
+        enum TimerID { EnumerationTimer = 0, WatchdogTimer = 1 };
+
         MidiDuplex(const juce::String deviceName, const juce::String bootloaderName) :
             midiOut(nullptr),
             midiIn(nullptr),
             device(deviceName),
             bootloader(bootloaderName),
             connectionState(State::Unavailable),
+            inputBackend(InputBackend::Juce),
+            inputFifoPriority(0),
+            inputCpuCore(-1),
+            loopback(nullptr),
             autoReconnect(false),
-            autoDisconnect(true)
+            autoDisconnect(true),
+            hasTimedOut(false),
+            reactorHandle(-1),
+            watchdogTimeout(TimeoutMilliseconds),
+            armedTimeout(0),
+            lastTrafficMs(0)
         {
             /* This timer doesn't ever stop: it handles unavailable/available signalling
-               even when automatic modes are switched off.
+               even when automatic modes are switched off. If the device watcher is
+               working, it only needs to poll occasionally as a fallback.
                MultiTimer is used here because it's often necessary to use other timers
                in inherited classes. */
-            startTimer(0, TimeoutMilliseconds);
+            deviceWatcher->addListener(this);
+            startTimer(EnumerationTimer, TimeoutMilliseconds);
          }
 
         // ------------------------------------------------------------------------
 
         ~MidiDuplex()
         {
+            deviceWatcher->removeListener(this);
             disconnect();
         }
 
@@ -42,6 +59,12 @@ namespace Midi
 
         bool canConnect(const Connection option = Connection::AsEither) const
         {
+            if (loopback)
+            {
+                const bool isBootloader = loopback->isLoopbackBootloader();
+                return (option == Connection::AsEither) || ((option == Connection::AsBootloader) == isBootloader);
+            }
+
             juce::String outputIdentifier, inputIdentifier;
             bool wouldConnectToBootloader;
             getIdentifiers(wouldConnectToBootloader, outputIdentifier, inputIdentifier);
@@ -80,20 +103,166 @@ namespace Midi
         {
             // reconnects when the connection drops
             autoReconnect = automaticReconnect;
-            startTimer(0, TimeoutMilliseconds);
+            startTimer(EnumerationTimer, TimeoutMilliseconds);
         }
         
         // ------------------------------------------------------------------------
 
         /** If this is set to true, the device will be marked as disconnected if
-            traffic stops for the length of TimeoutMilliseconds. For this to work,
-            the device would need either active sensing, or a guaranteed frequency
-            of traffic. */
+            traffic stops for the length of the watchdog timeout (see
+            setExpectedTrafficInterval). For this to work, the device would need
+            either active sensing, or a guaranteed frequency of traffic. */
         void setAutoDisconnect(const bool automaticDisconnect)
         {
             // disconnects when inbound traffic stops
             autoDisconnect = automaticDisconnect;
-            startTimer(0, TimeoutMilliseconds);
+            updateWatchdog();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Tells the watchdog how often the device should be sending. Its timeout
+            becomes WatchdogPeriods intervals (but at least MinimumTimeoutMilliseconds),
+            after a grace period for the stream to start. An interval of 0 says
+            that no traffic is expected, and disarms the watchdog; unplugging is
+            then noticed through the device list instead. Until this is called,
+            the timeout is TimeoutMilliseconds. Safe from any thread: this only
+            stores the timeout, and the watchdog's timer picks it up on the
+            message thread. */
+        void setExpectedTrafficInterval(const int intervalMilliseconds)
+        {
+            watchdogTimeout = (intervalMilliseconds > 0) ?
+                juce::jmax(MinimumTimeoutMilliseconds, intervalMilliseconds * WatchdogPeriods) : 0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Chooses how incoming data is read; this takes effect on the next
+            connection. InputBackend::AlsaSequencer reads the device directly
+            on Linux, with a thread for each device. InputBackend::AlsaReactor
+            shares one thread and one sequencer client between every device
+            that uses it, which is the better choice when there are many.
+            InputBackend::Jack reads a JACK MIDI port, and stamps each message
+            with its sample position (see getMessageSampleTime); it's only
+            built when SUPPERWARE_USE_JACK is defined. They all fall back to
+            JUCE if the port can't be opened that way (or on any other
+            platform). */
+        void setInputBackend(const InputBackend backend)
+        {
+            inputBackend = backend;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** When the AlsaSequencer backend is in use, its thread asks for SCHED_FIFO
+            scheduling at fifoPriority (1 to 99; 0 for normal scheduling) and is
+            pinned to cpuCore (-1 for any core). Takes effect on the next connection.
+            The JUCE backend's thread can't be configured like this. */
+        void setInputThreadScheduling(const int fifoPriority, const int cpuCore = -1)
+        {
+            inputFifoPriority = fifoPriority;
+            inputCpuCore = cpuCore;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Reports whether the input thread got the real-time scheduling it asked
+            for. Returns false for the JUCE backend, or if privileges were missing. */
+        bool isInputThreadRealtime() const
+        {
+#if JUCE_LINUX
+            if (alsaInput && alsaInput->isOpen())
+            {
+                return alsaInput->getThreadMode() == ThreadMode::Realtime;
+            }
+#endif
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Ties this duplex to one particular pair of ports, by the identifiers
+            in juce::MidiOutput/MidiInput::getAvailableDevices(), for when several
+            devices share a name. Empty strings go back to connecting to the first
+            port with the right name. A pinned duplex never connects to the
+            bootloader. The AlsaSequencer backend finds ports by name, so it
+            can't tell identical devices apart: pinned duplexes using it read
+            through JUCE instead. */
+        void setDeviceIdentifiers(const juce::String& outputIdentifier, const juce::String& inputIdentifier)
+        {
+            disconnect();
+            pinnedOutput = outputIdentifier;
+            pinnedInput = inputIdentifier;
+            startTimer(EnumerationTimer, 1);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Replaces the MIDI devices with an in-process port, such as a
+            SimulatedTracker, which then counts as an available device. Pass
+            nullptr to go back to hardware. The port must outlive the connection. */
+        void setLoopbackPort(LoopbackPort* port)
+        {
+            disconnect();
+            loopback = port;
+            startTimer(EnumerationTimer, 1);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The backend actually in use for the current connection. */
+        InputBackend getActiveInputBackend() const
+        {
+#if SUPPERWARE_USE_JACK
+            if (jackInput && jackInput->isOpen())
+            {
+                return InputBackend::Jack;
+            }
+#endif
+#if JUCE_LINUX
+            if (alsaInput && alsaInput->isOpen())
+            {
+                return InputBackend::AlsaSequencer;
+            }
+            if (reactorHandle >= 0)
+            {
+                return InputBackend::AlsaReactor;
+            }
+#endif
+            return InputBackend::Juce;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** With the Jack backend, the JACK frame time at which the message now
+            being handled arrived. It's only meaningful when called from a
+            callback for that message (an orientation callback, say), and is -1
+            for every other backend. See JackInput::getEventTime. */
+        int64_t getMessageSampleTime() const
+        {
+#if SUPPERWARE_USE_JACK
+            if (jackInput)
+            {
+                return jackInput->getEventTime();
+            }
+#endif
+            return -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** With the Jack backend, the JACK frame time at the start of the
+            current process cycle, or -1. Call it from an audio callback that
+            JACK is running, to place frames within the buffer. */
+        int64_t getCycleStartSampleTime() const
+        {
+#if SUPPERWARE_USE_JACK
+            if (jackInput)
+            {
+                return jackInput->getCycleStartTime();
+            }
+#endif
+            return -1;
         }
 
         // ------------------------------------------------------------------------
@@ -104,14 +273,30 @@ namespace Midi
             bool connectingToBootloader = false;
             getIdentifiers(connectingToBootloader, outputIdentifier, inputIdentifier);
             disconnect();
-            
-            if (outputIdentifier.isNotEmpty() && inputIdentifier.isNotEmpty())
+
+            if (loopback)
+            {
+                loopback->openLoopback(this);
+                setConnectionState(loopback->isLoopbackBootloader() ? State::Bootloader : State::Connected);
+            }
+            else if (outputIdentifier.isNotEmpty() && inputIdentifier.isNotEmpty())
             {
-                midiOut = juce::MidiOutput::openDevice(outputIdentifier);
-                midiIn  = juce::MidiInput::openDevice(inputIdentifier, this);
-                if (midiOut && midiIn)
                 {
-                    midiIn->start();
+                    const juce::ScopedLock sl(outputLock);
+                    midiOut = juce::MidiOutput::openDevice(outputIdentifier);
+                }
+                bool isInputOpen = openNativeInput(connectingToBootloader ? bootloader : device, inputIdentifier);
+                if (!isInputOpen)
+                {
+                    midiIn = juce::MidiInput::openDevice(inputIdentifier, this);
+                    isInputOpen = (midiIn != nullptr);
+                }
+                if (midiOut && isInputOpen)
+                {
+                    if (midiIn)
+                    {
+                        midiIn->start();
+                    }
                     setConnectionState(connectingToBootloader ? State::Bootloader : State::Connected);
                 }
                 else
@@ -131,38 +316,81 @@ namespace Midi
             {
                 midiIn->stop();
             }
+#if SUPPERWARE_USE_JACK
+            if (jackInput)
+            {
+                jackInput->close();
+            }
+#endif
+#if JUCE_LINUX
+            if (alsaInput)
+            {
+                alsaInput->close();
+            }
+            if (reactorHandle >= 0)
+            {
+                reactor->removeSource(reactorHandle);
+                reactorHandle = -1;
+            }
+#endif
+            if (loopback)
+            {
+                loopback->closeLoopback();
+            }
             midiIn = nullptr;
-            midiOut = nullptr;
+            {
+                const juce::ScopedLock sl(outputLock);
+                midiOut = nullptr;
+            }
             setConnectionState(State::Unavailable);
         }
 
         // ------------------------------------------------------------------------
 
+        /** Safe from any thread, but may wait for the device. */
         void sendMessage(const juce::MidiMessage& message)
         {
+            const juce::ScopedLock sl(outputLock);
             if (midiOut)
             {
                 midiOut->sendMessageNow(message);
             }
+            else if (loopback && isConnected())
+            {
+                loopback->loopbackMessage(message.getRawData(), static_cast<size_t>(message.getRawDataSize()));
+            }
         }
 
         // ------------------------------------------------------------------------
 
-        void handleIncomingMidiMessage(juce::MidiInput* /*source*/, const juce::MidiMessage& message) override
+        /** The same, from raw bytes. A loopback port takes them as they are;
+            a MIDI output needs a juce::MidiMessage, so that allocates. */
+        void sendMessage(const uint8_t* data, const size_t numBytes)
         {
-            if (autoDisconnect)
+            const juce::ScopedLock sl(outputLock);
+            if (midiOut)
+            {
+                midiOut->sendMessageNow(juce::MidiMessage(data, static_cast<int>(numBytes)));
+            }
+            else if (loopback && isConnected())
             {
-                startTimer(0, TimeoutMilliseconds);
+                loopback->loopbackMessage(data, numBytes);
             }
+        }
+
+        // ------------------------------------------------------------------------
 
+        void handleIncomingMidiMessage(juce::MidiInput* /*source*/, const juce::MidiMessage& message) override
+        {
             if (message.isSysEx())
             {
                 const uint8_t* m = message.getSysExData();
                 const size_t s = message.getSysExDataSize();
-                handleSysEx(m, s);
+                sysexReceived(m, s);
             }
             else
             {
+                noteTraffic();
                 handleMidi(message);
             }
         }
@@ -171,13 +399,23 @@ namespace Midi
 
         void timerCallback(int timerID) override
         {
-            if (timerID != 0) return;
+            if (timerID == WatchdogTimer)
+            {
+                checkWatchdog();
+                return;
+            }
+            if (timerID != EnumerationTimer) return;
 
             if (connectionState == State::Connected)
             {
-                // hit this timer because data flow has stopped
-                if (autoDisconnect)
+                if (hasTimedOut.exchange(false) && autoDisconnect)
+                {
+                    // the reactor keeps its own watchdog, and says when data flow has stopped
+                    disconnect();
+                }
+                else if (autoDisconnect && !canConnect(Connection::AsDevice))
                 {
+                    // something was unplugged, and it was us
                     disconnect();
                 }
             }
@@ -199,16 +437,37 @@ namespace Midi
             {
                 setConnectionState(State::Unavailable);
             }
+
+            // without a watcher, polling is the only way to notice an unplug
+            startTimer(EnumerationTimer, deviceWatcher->isWatching() ? FallbackPollMilliseconds : TimeoutMilliseconds);
         }
 
         // ------------------------------------------------------------------------
 
     protected:
         std::unique_ptr<juce::MidiOutput> midiOut;
+        juce::CriticalSection outputLock;
         std::unique_ptr<juce::MidiInput> midiIn;
         juce::String device, bootloader;
+        juce::String pinnedOutput, pinnedInput;
         State connectionState;
+        InputBackend inputBackend;
+        int inputFifoPriority, inputCpuCore;
+        LoopbackPort* loopback;
         bool autoReconnect, autoDisconnect;
+        std::atomic<bool> hasTimedOut;
+        std::atomic<int> reactorHandle;
+        std::atomic<int> watchdogTimeout;
+        int armedTimeout; // the timeout the watchdog is using: only touched on the message thread
+        std::atomic<uint32_t> lastTrafficMs;
+        SharedDeviceWatcher deviceWatcher;
+#if SUPPERWARE_USE_JACK
+        std::unique_ptr<JackInput> jackInput;
+#endif
+#if JUCE_LINUX
+        std::unique_ptr<AlsaSeqInput> alsaInput;
+        juce::SharedResourcePointer<AlsaReactor> reactor;
+#endif
 
         // ------------------------------------------------------------------------
 
@@ -223,6 +482,7 @@ namespace Midi
             if (newState != connectionState)
             {
                 connectionState = newState;
+                updateWatchdog();
                 connectionStateChanged();
             }
         }
@@ -242,8 +502,32 @@ namespace Midi
 
         // ------------------------------------------------------------------------
 
+        static bool containsIdentifier(const juce::Array<juce::MidiDeviceInfo>& mdInfo, const juce::String& identifier)
+        {
+            for (const juce::MidiDeviceInfo& info : mdInfo)
+            {
+                if (info.identifier == identifier)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
         void getIdentifiers(bool& wouldConnectToBootloader, juce::String& outputIdentifier, juce::String& inputIdentifier) const
         {
+            if (pinnedOutput.isNotEmpty() || pinnedInput.isNotEmpty())
+            {
+                wouldConnectToBootloader = false;
+                const bool isPresent = containsIdentifier(juce::MidiOutput::getAvailableDevices(), pinnedOutput) &&
+                                       containsIdentifier(juce::MidiInput::getAvailableDevices(), pinnedInput);
+                outputIdentifier = isPresent ? pinnedOutput : juce::String();
+                inputIdentifier = isPresent ? pinnedInput : juce::String();
+                return;
+            }
+
             const juce::Array<juce::MidiDeviceInfo>& outInfo = juce::MidiOutput::getAvailableDevices();
             outputIdentifier = findIdentifierInMidiInfo(outInfo, device);
             if (outputIdentifier.isNotEmpty())
@@ -275,5 +559,143 @@ namespace Midi
 
     private:
         static constexpr int TimeoutMilliseconds = 600;
+        static constexpr int FallbackPollMilliseconds = 5000;
+        static constexpr int WatchdogPeriods = 5;
+        static constexpr int MinimumTimeoutMilliseconds = 300;
+        static constexpr int StartupGraceMilliseconds = 500;
+        static constexpr int WatchdogCheckMilliseconds = 100;
+
+        // ------------------------------------------------------------------------
+
+        void noteTraffic()
+        {
+            lastTrafficMs.store(juce::Time::getMillisecondCounter(), std::memory_order_relaxed);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Runs the watchdog's timer while it's wanted. Called on the message
+            thread, like everything else that starts and stops timers here. */
+        void updateWatchdog()
+        {
+            armedTimeout = 0;
+#if JUCE_LINUX
+            if (reactorHandle >= 0)
+            {
+                reactor->setTimeout(reactorHandle, 0, 0);
+            }
+#endif
+            if (autoDisconnect && (connectionState == State::Connected))
+            {
+                startTimer(WatchdogTimer, WatchdogCheckMilliseconds);
+                checkWatchdog();
+            }
+            else
+            {
+                stopTimer(WatchdogTimer);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Brings the watchdog up to date with setExpectedTrafficInterval, and
+            disconnects if the device has gone quiet. Arming from 0 allows
+            StartupGraceMilliseconds for the first message to arrive. Each
+            message only stores its arrival time, on the input thread, so a
+            busy message thread can make this late, but not wrong. The reactor
+            checks its own sources instead, and says when one has stopped. */
+        void checkWatchdog()
+        {
+            const int timeout = watchdogTimeout;
+            if (timeout != armedTimeout)
+            {
+                const int grace = (armedTimeout == 0) ? StartupGraceMilliseconds : 0;
+                armedTimeout = timeout;
+#if JUCE_LINUX
+                if (reactorHandle >= 0)
+                {
+                    reactor->setTimeout(reactorHandle, timeout, grace);
+                    return;
+                }
+#endif
+                if (grace > 0)
+                {
+                    lastTrafficMs = juce::Time::getMillisecondCounter() + static_cast<uint32_t>(grace);
+                }
+            }
+#if JUCE_LINUX
+            if (reactorHandle >= 0)
+            {
+                return;
+            }
+#endif
+            const int32_t silence = static_cast<int32_t>(juce::Time::getMillisecondCounter() - lastTrafficMs.load());
+            if ((timeout > 0) && (silence > timeout))
+            {
+                disconnect();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Every input backend delivers sysex through here. */
+        void sysexReceived(const uint8_t* data, const size_t numBytes) override
+        {
+            noteTraffic();
+            handleSysEx(data, numBytes);
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool openNativeInput(const juce::String& portName, const juce::String& identifier)
+        {
+#if SUPPERWARE_USE_JACK
+            if ((inputBackend == InputBackend::Jack) && pinnedInput.isEmpty())
+            {
+                if (!jackInput)
+                {
+                    jackInput.reset(new JackInput(this));
+                }
+                return jackInput->open(portName);
+            }
+#endif
+#if JUCE_LINUX
+            if (inputBackend == InputBackend::AlsaReactor)
+            {
+                hasTimedOut = false;
+                reactorHandle = reactor->addSource(identifier, portName, this);
+                return reactorHandle >= 0;
+            }
+            if ((inputBackend == InputBackend::AlsaSequencer) && pinnedInput.isEmpty())
+            {
+                if (!alsaInput)
+                {
+                    alsaInput.reset(new AlsaSeqInput(this));
+                }
+                alsaInput->setScheduling(inputFifoPriority, inputCpuCore);
+                return alsaInput->open(portName);
+            }
+#else
+            juce::ignoreUnused(portName, identifier);
+#endif
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void reactorTimedOut() override
+        {
+            // called on the reactor thread: let the message thread disconnect
+            hasTimedOut = true;
+            startTimer(EnumerationTimer, 1);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void midiDevicesChanged() override
+        {
+            // called on the watcher thread: check the device list promptly on the message thread
+            startTimer(EnumerationTimer, 1);
+        }
     };
 };
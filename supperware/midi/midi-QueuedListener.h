@@ -0,0 +1,169 @@
+/*
+ * MIDI drivers
+ * Delivers tracker frames to a listener on its own thread, through a FrameQueue
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Stands between a TrackerDriver and a slow listener, so that the listener
+        can't hold up the MIDI input thread (or any other listener). Orientation
+        frames are pushed into a FrameQueue on the MIDI thread, and passed on
+        to the listener from this object's own thread. The rarer state callbacks
+        (compass, connection) are passed on straight away, on the MIDI thread.
+        The consumer thread is only woken when a frame arrives in an empty
+        queue. The MIDI thread mustn't wait for the listener, so
+        OverflowPolicy::Block isn't allowed here: it's treated as KeepOldest. */
+    class QueuedListener : public TrackerDriver::Listener, private juce::Thread
+    {
+    public:
+        QueuedListener(TrackerDriver& trackerDriver, TrackerDriver::Listener* listener,
+            const size_t capacity = 8, const OverflowPolicy overflowPolicy = OverflowPolicy::KeepNewest) :
+            juce::Thread("Head tracker listener queue"),
+            td(trackerDriver),
+            l(listener),
+            queue(capacity, (overflowPolicy == OverflowPolicy::Block) ? OverflowPolicy::KeepOldest : overflowPolicy)
+        {
+            jassert(overflowPolicy != OverflowPolicy::Block);
+            startThread();
+            td.addListener(this);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~QueuedListener()
+        {
+            td.removeListener(this);
+            queue.close();
+            signalThreadShouldExit();
+            frameReady.signal();
+            stopThread(WaitMilliseconds * 4);
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getQueueDepth() const
+        {
+            return queue.getDepth();
+        }
+
+        // ------------------------------------------------------------------------
+
+        size_t getMaxQueueDepth() const
+        {
+            return queue.getMaxDepth();
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getDroppedFrames() const
+        {
+            return queue.getDroppedFrames();
+        }
+
+        // ------------------------------------------------------------------------
+
+        void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::YPR;
+            f.values[0] = yawRadian;
+            f.values[1] = pitchRadian;
+            f.values[2] = rollRadian;
+            enqueue(f);
+        }
+
+        void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::Quaternion;
+            f.values[0] = qw;
+            f.values[1] = qx;
+            f.values[2] = qy;
+            f.values[3] = qz;
+            enqueue(f);
+        }
+
+        void trackerOrientationM(float* matrix) override
+        {
+            OrientationFrame f;
+            f.type = OrientationFrame::Type::Matrix;
+            memcpy(f.values, matrix, sizeof(f.values));
+            enqueue(f);
+        }
+
+        void trackerCompassStateChanged(Tracker::CompassState compassState) override
+        {
+            l->trackerCompassStateChanged(compassState);
+        }
+
+        void trackerConnectionChanged(const Tracker::State& state) override
+        {
+            l->trackerConnectionChanged(state);
+        }
+
+        void trackerMidiConnectionChanged(Midi::State state) override
+        {
+            l->trackerMidiConnectionChanged(state);
+        }
+
+        void trackerStreamRestored(double milliseconds) override
+        {
+            l->trackerStreamRestored(milliseconds);
+        }
+
+        /** Only the queueing is timed on the MIDI thread. */
+        juce::String getListenerName() const override
+        {
+            return "Queue for " + l->getListenerName();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int WaitMilliseconds = 100;
+
+        TrackerDriver& td;
+        TrackerDriver::Listener* l;
+        FrameQueue queue;
+        juce::WaitableEvent frameReady;
+
+        // ------------------------------------------------------------------------
+
+        void enqueue(OrientationFrame& f)
+        {
+            td.timestampFrame(f);
+            if (queue.push(f))
+            {
+                frameReady.signal();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            OrientationFrame f;
+            while (!threadShouldExit())
+            {
+                frameReady.wait(WaitMilliseconds);
+                while (queue.pop(f))
+                {
+                    switch (f.type)
+                    {
+                    case OrientationFrame::Type::YPR:
+                        l->trackerOrientation(f.values[0], f.values[1], f.values[2]);
+                        break;
+                    case OrientationFrame::Type::Quaternion:
+                        l->trackerOrientationQ(f.values[0], f.values[1], f.values[2], f.values[3]);
+                        break;
+                    default:
+                        l->trackerOrientationM(f.values);
+                    }
+                }
+            }
+        }
+    };
+};
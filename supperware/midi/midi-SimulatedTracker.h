@@ -0,0 +1,314 @@
+/*
+ * MIDI drivers
+ * A simulated head tracker, as an ALSA port or an in-process loopback
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_LINUX
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#endif
+
+namespace Midi
+{
+    /** Runs a TrackerSimulator in real time on its own thread, so that
+        MidiDuplex, TrackerDriver and HeadPanel can be tested without a head
+        tracker. There are two ways to reach it:
+        - In-process: pass it to MidiDuplex::setLoopbackPort(). No MIDI system
+          is involved, so this works anywhere, including on build servers.
+        - On Linux, openVirtualPort() creates an ALSA sequencer port named like
+          the real device, which any driver (in this process or another) will
+          find and connect to as if it were hardware.
+        Disconnect any MidiDuplex using it before it's destroyed. */
+    class SimulatedTracker : public LoopbackPort, private juce::Thread,
+        private SysexParser::Listener, private TrackerSimulator::Output
+    {
+    public:
+        SimulatedTracker() :
+            juce::Thread("Head tracker simulator"),
+            simulator(this),
+            hostParser(this),
+            portParser(this),
+            receiver(nullptr),
+#if JUCE_LINUX
+            seq(nullptr),
+            localPort(-1),
+#endif
+            startMs(juce::Time::getMillisecondCounterHiRes())
+        {
+            startThread();
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~SimulatedTracker()
+        {
+            stopThread(MaxWaitMilliseconds * 4);
+#if JUCE_LINUX
+            closeVirtualPort();
+#endif
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** See TrackerSimulator::setSyntheticMotion. */
+        void setSyntheticMotion(float yawAmplitude, float yawHz, float pitchAmplitude, float pitchHz,
+            float rollAmplitude, float rollHz)
+        {
+            const juce::ScopedLock sl(lock);
+            simulator.setSyntheticMotion(yawAmplitude, yawHz, pitchAmplitude, pitchHz, rollAmplitude, rollHz);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** See TrackerSimulator::setRecordedMotion. */
+        void setRecordedMotion(const float* ypr, const size_t numFrames, const float frameRate)
+        {
+            const juce::ScopedLock sl(lock);
+            simulator.setRecordedMotion(ypr, numFrames, frameRate);
+        }
+
+        // ------------------------------------------------------------------------
+
+        uint64_t getNumFramesSent() const
+        {
+            const juce::ScopedLock sl(lock);
+            return simulator.getNumFramesSent();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The frame rate the host last asked for. */
+        bool is100Hz() const
+        {
+            const juce::ScopedLock sl(lock);
+            return simulator.is100Hz();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** See TrackerSimulator::setBootloaderMode. A connected duplex should
+            reconnect afterwards, to see the change. */
+        void setBootloaderMode(const bool isBootloaderMode)
+        {
+            const juce::ScopedLock sl(lock);
+            simulator.setBootloaderMode(isBootloaderMode);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** See TrackerSimulator::setLinkRate. */
+        void setLinkRate(const double bytesPerSecond)
+        {
+            const juce::ScopedLock sl(lock);
+            simulator.setLinkRate(bytesPerSecond);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The image received by the simulated bootloader. Don't call this during
+            a transfer. */
+        const std::vector<uint8_t>& getReceivedFirmware() const
+        {
+            const juce::ScopedLock sl(lock);
+            return simulator.getFirmwareReceiver().getImage();
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isLoopbackBootloader() const override
+        {
+            const juce::ScopedLock sl(lock);
+            return simulator.isBootloaderMode();
+        }
+
+        // ------------------------------------------------------------------------
+
+#if JUCE_LINUX
+        /** Creates an ALSA sequencer port that can be read and written by other
+            clients. Returns false if the sequencer isn't available. */
+        bool openVirtualPort(const juce::String& portName = "Head Tracker MIDI 1")
+        {
+            stopThread(MaxWaitMilliseconds * 4);
+            closeVirtualPort();
+            if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) >= 0)
+            {
+                snd_seq_set_client_name(seq, "Head Tracker Simulator");
+                localPort = snd_seq_create_simple_port(seq, portName.toRawUTF8(),
+                    SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ |
+                    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                    SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+                if (localPort < 0)
+                {
+                    snd_seq_close(seq);
+                    seq = nullptr;
+                }
+            }
+            else
+            {
+                seq = nullptr;
+            }
+            portParser.reset();
+            startThread();
+            return seq != nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void closeVirtualPort()
+        {
+            const bool wasRunning = isThreadRunning();
+            stopThread(MaxWaitMilliseconds * 4);
+            if (seq)
+            {
+                snd_seq_close(seq);
+                seq = nullptr;
+            }
+            localPort = -1;
+            if (wasRunning)
+            {
+                startThread();
+            }
+        }
+#endif
+
+        // ------------------------------------------------------------------------
+
+        void openLoopback(SysexParser::Listener* newReceiver) override
+        {
+            const juce::ScopedLock sl(lock);
+            hostParser.reset();
+            receiver = newReceiver;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void closeLoopback() override
+        {
+            const juce::ScopedLock sl(lock);
+            receiver = nullptr;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void loopbackMessage(const uint8_t* data, const size_t numBytes) override
+        {
+            {
+                const juce::ScopedLock sl(lock);
+                hostParser.parse(data, numBytes);
+            }
+            // wake the thread, so that any reply goes straight back
+            notify();
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int MaxWaitMilliseconds = 100;
+#if JUCE_LINUX
+        static constexpr int MaxDescriptors = 4;
+#endif
+
+        juce::CriticalSection lock;
+        TrackerSimulator simulator;
+        SysexParser hostParser, portParser;
+        SysexParser::Listener* receiver;
+#if JUCE_LINUX
+        snd_seq_t* seq;
+        int localPort;
+#endif
+        const double startMs;
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+#if JUCE_LINUX
+            struct pollfd fds[MaxDescriptors];
+            int numFds = 0;
+            if (seq)
+            {
+                numFds = snd_seq_poll_descriptors_count(seq, POLLIN);
+                if (numFds > MaxDescriptors) numFds = MaxDescriptors;
+                snd_seq_poll_descriptors(seq, fds, static_cast<unsigned int>(numFds), POLLIN);
+            }
+#endif
+            while (!threadShouldExit())
+            {
+                int waitMilliseconds;
+                {
+                    const juce::ScopedLock sl(lock);
+                    simulator.advanceTo((juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001);
+                    waitMilliseconds = static_cast<int>(ceil(simulator.getSecondsToNextEvent() * 1000.0));
+                }
+                if (waitMilliseconds > MaxWaitMilliseconds)
+                {
+                    waitMilliseconds = MaxWaitMilliseconds;
+                }
+
+#if JUCE_LINUX
+                if (numFds)
+                {
+                    if (poll(fds, static_cast<nfds_t>(numFds), waitMilliseconds) > 0)
+                    {
+                        readVirtualPort();
+                    }
+                    continue;
+                }
+#endif
+                wait(waitMilliseconds);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+#if JUCE_LINUX
+        void readVirtualPort()
+        {
+            snd_seq_event_t* event = nullptr;
+            while (snd_seq_event_input(seq, &event) >= 0)
+            {
+                if (event && (event->type == SND_SEQ_EVENT_SYSEX))
+                {
+                    const juce::ScopedLock sl(lock);
+                    portParser.parse(static_cast<const uint8_t*>(event->data.ext.ptr),
+                        static_cast<size_t>(event->data.ext.len));
+                }
+            }
+        }
+#endif
+
+        // ------------------------------------------------------------------------
+
+        /** From either parser, with the lock held. */
+        void sysexReceived(const uint8_t* data, const size_t numBytes) override
+        {
+            simulator.receiveSysex(data, numBytes);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** From the simulator, with the lock held. */
+        void simulatorSysex(const uint8_t* data, const size_t numBytes) override
+        {
+            if (receiver)
+            {
+                receiver->sysexReceived(data + 1, numBytes - 2);
+            }
+#if JUCE_LINUX
+            if (seq)
+            {
+                snd_seq_event_t event;
+                snd_seq_ev_clear(&event);
+                snd_seq_ev_set_source(&event, localPort);
+                snd_seq_ev_set_subs(&event);
+                snd_seq_ev_set_direct(&event);
+                snd_seq_ev_set_sysex(&event, static_cast<unsigned int>(numBytes), const_cast<uint8_t*>(data));
+                snd_seq_event_output_direct(seq, &event);
+            }
+#endif
+        }
+    };
+};
@@ -0,0 +1,441 @@
+/*
+ * MIDI drivers
+ * Listeners subscribed to events by bitmask, in a list that's read without locking
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** How long one listener's callbacks take, and how many of them took longer
+        than the budget. Recorded on whichever thread makes the calls; read
+        from any. */
+    struct CallTiming
+    {
+        CallTiming() :
+            overBudget(0)
+        {}
+
+        void record(const uint64_t microseconds, const uint64_t budgetMicroseconds)
+        {
+            histogram.record(microseconds);
+            if (microseconds > budgetMicroseconds)
+            {
+                overBudget.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /** Calls function(), and records how long it took on the
+            high-resolution clock. */
+        template <typename Function>
+        void time(Function function, const uint64_t budgetMicroseconds)
+        {
+            const int64_t start = juce::Time::getHighResolutionTicks();
+            function();
+            const int64_t elapsed = juce::Time::getHighResolutionTicks() - start;
+            record(static_cast<uint64_t>(elapsed * 1000000 / juce::Time::getHighResolutionTicksPerSecond()), budgetMicroseconds);
+        }
+
+        bool isOverBudget() const
+        {
+            return overBudget.load(std::memory_order_relaxed) > 0;
+        }
+
+        LatencyHistogram histogram;
+        std::atomic<uint64_t> overBudget;
+    };
+
+    // ----------------------------------------------------------------------------
+
+    /** Holds listeners, each subscribed to some of NumEvents kinds of event by
+        a bitmask, and calls only the ones subscribed to an event. For every
+        event there's a ready-made array of its subscribers.
+
+        The arrays are read-copy-update snapshots. call() reads the current
+        snapshot without locking or allocating, so events can be sent from a
+        MIDI or audio thread. add() and remove() build a new snapshot under a
+        lock and publish it; the old one is freed by a later add() or
+        remove(), once every call() that was reading it has finished. Nobody
+        waits for that: the last reader out notes that it's safe.
+
+        remove() also marks the listener's subscription as gone, which every
+        snapshot shares, so no new call to it starts anywhere. If a call to it
+        is in progress on another thread, remove() waits for that call (and
+        only that call) to finish. So once remove() returns, the listener
+        won't be called again, and can be destroyed. The exception is
+        remove() from inside one of this list's own callbacks: it doesn't
+        wait, so that two threads can't end up waiting for each other, and a
+        call to that listener already under way on another thread may still
+        be finishing.
+
+        With setTiming, every call is timed on the high-resolution clock, and
+        recorded in a CallTiming for its listener. Switched off, it costs one
+        atomic load per event. */
+    template <typename ListenerType, int NumEvents>
+    class SubscriberList
+    {
+    public:
+        SubscriberList() :
+            current(new Snapshot()),
+            readers(0),
+            generation(0),
+            quiescentGeneration(0),
+            isTiming(false),
+            budget(0)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** Don't destroy this while call() is in progress on another thread. */
+        ~SubscriberList()
+        {
+            delete current.load();
+            for (const Retired& r : retired)
+            {
+                delete r.snapshot;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Adds a listener, or changes its events if it's already here. An
+            events mask of 0 removes it. */
+        void add(ListenerType* listener, const uint32_t events)
+        {
+            std::shared_ptr<Slot> removed;
+            {
+                const juce::ScopedLock sl(writeLock);
+                Snapshot* s = new Snapshot();
+                s->subscriptions = current.load()->subscriptions;
+                bool isFound = false;
+                for (Subscription& sub : s->subscriptions)
+                {
+                    if (sub.listener == listener)
+                    {
+                        sub.events = events;
+                        isFound = true;
+                        if (events == 0)
+                        {
+                            sub.slot->isActive = false;
+                            removed = sub.slot;
+                        }
+                    }
+                }
+                if (!isFound && (events != 0))
+                {
+                    s->subscriptions.push_back({ listener, events, std::make_shared<Slot>() });
+                }
+                publish(s);
+                reclaim();
+            }
+            if (removed && !isInsideCall())
+            {
+                // not under the lock, in case the call we're waiting for wants it
+                while (removed->numCalls.load() > 0)
+                {
+                    juce::Thread::yield();
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void remove(ListenerType* listener)
+        {
+            add(listener, 0);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The events a listener is subscribed to, or 0. */
+        uint32_t getEvents(ListenerType* listener) const
+        {
+            const juce::ScopedLock sl(writeLock);
+            for (const Subscription& sub : current.load()->subscriptions)
+            {
+                if (sub.listener == listener)
+                {
+                    return sub.events;
+                }
+            }
+            return 0;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Calls function(listener) for every listener subscribed to an event. */
+        template <typename Function>
+        void call(const int event, Function function)
+        {
+            const ReadFrame frame(*this);
+            const std::vector<Entry>& entries = frame.snapshot->byEvent[event];
+            if (!isTiming.load(std::memory_order_relaxed))
+            {
+                for (const Entry& e : entries)
+                {
+                    const ActiveCall active(*e.slot);
+                    if (active)
+                    {
+                        function(e.listener);
+                    }
+                }
+                return;
+            }
+
+            const uint64_t budgetMicroseconds = budget.load(std::memory_order_relaxed);
+            for (const Entry& e : entries)
+            {
+                const ActiveCall active(*e.slot);
+                if (active)
+                {
+                    e.slot->timing.time([&function, &e] { function(e.listener); }, budgetMicroseconds);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Starts or stops timing each call. Calls over the budget are counted
+            separately. The timings are kept for as long as the listener is. */
+        void setTiming(const bool shouldTime, const uint64_t budgetMicroseconds)
+        {
+            budget = budgetMicroseconds;
+            isTiming = shouldTime;
+        }
+
+        bool isTimingCalls() const
+        {
+            return isTiming;
+        }
+
+        uint64_t getBudget() const
+        {
+            return budget;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The listener pointer is only for identification: by the time it's
+            read, the listener may have been removed. */
+        struct Timing
+        {
+            const ListenerType* listener;
+            juce::String name;
+            std::shared_ptr<const CallTiming> timing;
+        };
+
+        /** Every listener's timing, with a name from describe(listener).
+            describe() is called like any callback, with no lock held: it may
+            add or remove listeners, and a remove() on another thread waits
+            for it. This allocates, so call it from the message thread. The
+            timings stay valid even if the listener is removed. */
+        template <typename Describe>
+        std::vector<Timing> getTimings(Describe describe) const
+        {
+            const ReadFrame frame(*this);
+            std::vector<Timing> timings;
+            for (const Subscription& sub : frame.snapshot->subscriptions)
+            {
+                const ActiveCall active(*sub.slot);
+                if (active)
+                {
+                    timings.push_back({ sub.listener, describe(sub.listener),
+                        std::shared_ptr<const CallTiming>(sub.slot, &sub.slot->timing) });
+                }
+            }
+            return timings;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        /** What every snapshot knows about one subscription: whether it has
+            been removed, how many calls to it are in progress, and their
+            timing. */
+        struct Slot
+        {
+            Slot() :
+                isActive(true),
+                numCalls(0)
+            {}
+
+            CallTiming timing;
+            std::atomic<bool> isActive;
+            std::atomic<int> numCalls;
+        };
+
+        struct Subscription
+        {
+            ListenerType* listener;
+            uint32_t events;
+            std::shared_ptr<Slot> slot;
+        };
+
+        struct Entry
+        {
+            ListenerType* listener;
+            Slot* slot; // owned by the snapshot's subscriptions
+        };
+
+        struct Snapshot
+        {
+            std::vector<Subscription> subscriptions;
+            std::vector<Entry> byEvent[NumEvents];
+        };
+
+        /** Marks a call in progress, unless its listener has been removed. The
+            count goes up before the flag is checked, and remove() clears the
+            flag before it looks at the count, so either the call sees the
+            removal, or remove() sees the call. */
+        struct ActiveCall
+        {
+            ActiveCall(Slot& callSlot) :
+                slot(callSlot)
+            {
+                slot.numCalls.fetch_add(1);
+                isActive = slot.isActive.load();
+            }
+
+            ~ActiveCall()
+            {
+                slot.numCalls.fetch_sub(1);
+            }
+
+            explicit operator bool() const
+            {
+                return isActive;
+            }
+
+            Slot& slot;
+            bool isActive;
+        };
+
+        /** Marks a call() in progress. The frames on each thread are chained
+            together, so that remove() can tell whether it's being called from
+            one of this list's callbacks. The last reader out notes that every
+            snapshot retired before it left can be freed. */
+        struct ReadFrame
+        {
+            ReadFrame(const SubscriberList& subscriberList) :
+                list(subscriberList),
+                previous(topFrame())
+            {
+                topFrame() = this;
+                list.readers.fetch_add(1);
+                snapshot = list.current.load();
+            }
+
+            ~ReadFrame()
+            {
+                const uint64_t retiredSoFar = list.generation.load();
+                if (list.readers.fetch_sub(1) == 1)
+                {
+                    list.noteQuiescent(retiredSoFar);
+                }
+                topFrame() = previous;
+            }
+
+            const SubscriberList& list;
+            ReadFrame* previous;
+            const Snapshot* snapshot;
+        };
+
+        struct Retired
+        {
+            Snapshot* snapshot;
+            uint64_t generation;
+        };
+
+        juce::CriticalSection writeLock;
+        std::atomic<Snapshot*> current;
+        mutable std::atomic<int> readers;
+        std::atomic<uint64_t> generation;
+        mutable std::atomic<uint64_t> quiescentGeneration;
+        std::vector<Retired> retired; // guarded by writeLock
+        std::atomic<bool> isTiming;
+        std::atomic<uint64_t> budget;
+
+        // ------------------------------------------------------------------------
+
+        static ReadFrame*& topFrame()
+        {
+            static thread_local ReadFrame* top = nullptr;
+            return top;
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool isInsideCall() const
+        {
+            for (const ReadFrame* f = topFrame(); f; f = f->previous)
+            {
+                if (&f->list == this)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Builds the per-event arrays, and swaps the new snapshot in. */
+        void publish(Snapshot* s)
+        {
+            std::vector<Subscription>& subs = s->subscriptions;
+            subs.erase(std::remove_if(subs.begin(), subs.end(),
+                [](const Subscription& sub) { return sub.events == 0; }), subs.end());
+            for (const Subscription& sub : subs)
+            {
+                for (int e = 0; e < NumEvents; ++e)
+                {
+                    if (sub.events & (1u << e))
+                    {
+                        s->byEvent[e].push_back({ sub.listener, sub.slot.get() });
+                    }
+                }
+            }
+            retired.push_back({ current.exchange(s), ++generation });
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Records that no reader can still hold a snapshot retired at or
+            before this generation. The generation is read before the moment
+            with no readers, and any reader arriving after that moment gets a
+            newer snapshot, as readers count themselves in before loading it. */
+        void noteQuiescent(const uint64_t retiredSoFar) const
+        {
+            uint64_t q = quiescentGeneration.load();
+            while ((q < retiredSoFar) && !quiescentGeneration.compare_exchange_weak(q, retiredSoFar))
+            {
+                // q has been reloaded: try again, unless another reader has gone further
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Frees the retired snapshots that nobody can be reading. Called with
+            writeLock held; never waits. Whatever's still in use is freed by a
+            later call, or by the destructor. */
+        void reclaim()
+        {
+            const uint64_t retiredSoFar = generation.load();
+            if (readers.load() == 0)
+            {
+                noteQuiescent(retiredSoFar);
+            }
+            const uint64_t safeGeneration = quiescentGeneration.load();
+            retired.erase(std::remove_if(retired.begin(), retired.end(), [safeGeneration](const Retired& r)
+                {
+                    if (r.generation > safeGeneration)
+                    {
+                        return false;
+                    }
+                    delete r.snapshot;
+                    return true;
+                }), retired.end());
+        }
+    };
+};
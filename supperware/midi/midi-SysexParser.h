@@ -0,0 +1,125 @@
+/*
+ * MIDI drivers
+ * Extracts System Exclusive messages from a raw MIDI byte stream
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Turns raw MIDI bytes, delivered in chunks of any size, into complete
+        System Exclusive messages. A message that arrives whole within one chunk
+        is passed straight to the listener from the caller's memory; only
+        messages split across chunks, or interrupted by real-time bytes, are
+        copied into the parser's own fixed buffer. It never allocates.
+        Other MIDI messages are ignored: the head tracker doesn't send any. */
+    class SysexParser
+    {
+    public:
+        class Listener
+        {
+        public:
+            virtual ~Listener() {};
+
+            /** As with juce::MidiMessage::getSysExData, the data is stripped of
+                the leading 0xF0 and trailing 0xF7. It's only valid for the
+                duration of the call. */
+            virtual void sysexReceived(const uint8_t* data, const size_t numBytes) = 0;
+        };
+
+        // ------------------------------------------------------------------------
+
+        SysexParser(Listener* listener) :
+            l(listener),
+            count(0),
+            isAssembling(false),
+            hasOverflowed(false)
+        {}
+
+        // ------------------------------------------------------------------------
+
+        /** Forgets any partly-received message. */
+        void reset()
+        {
+            count = 0;
+            isAssembling = false;
+            hasOverflowed = false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void parse(const uint8_t* data, const size_t numBytes)
+        {
+            size_t i = 0;
+            while (i < numBytes)
+            {
+                if (!isAssembling)
+                {
+                    if (data[i] != 0xf0)
+                    {
+                        ++i;
+                        continue;
+                    }
+
+                    // is the whole message in this chunk, with nothing in the way?
+                    size_t j = i + 1;
+                    while ((j < numBytes) && (data[j] < 0x80))
+                    {
+                        ++j;
+                    }
+                    if ((j < numBytes) && (data[j] == 0xf7))
+                    {
+                        l->sysexReceived(data + i + 1, j - i - 1);
+                        i = j + 1;
+                        continue;
+                    }
+
+                    isAssembling = true;
+                    hasOverflowed = false;
+                    count = 0;
+                    ++i;
+                    continue;
+                }
+
+                const uint8_t b = data[i];
+                if (b < 0x80)
+                {
+                    if (count < MaxSysexBytes)
+                    {
+                        buffer[count++] = b;
+                    }
+                    else
+                    {
+                        hasOverflowed = true;
+                    }
+                }
+                else if (b == 0xf7)
+                {
+                    if (!hasOverflowed)
+                    {
+                        l->sysexReceived(buffer, count);
+                    }
+                    isAssembling = false;
+                }
+                else if (b < 0xf8)
+                {
+                    // any other status byte abandons the message, and may start a new one
+                    isAssembling = false;
+                    continue;
+                }
+                // real-time bytes (0xF8 and above) may appear anywhere, and are ignored
+                ++i;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr size_t MaxSysexBytes = 256;
+        Listener* l;
+        uint8_t buffer[MaxSysexBytes];
+        size_t count;
+        bool isAssembling, hasOverflowed;
+    };
+};
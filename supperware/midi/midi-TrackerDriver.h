@@ -9,7 +9,44 @@
 
 namespace Midi
 {
-    class TrackerDriver: public MidiDuplex, Tracker::Listener
+    /** Commands are posted to a lock-free queue and sent from the driver's own
+        thread, so any thread can issue them without waiting for the MIDI
+        device. On Linux and macOS, the sender is woken without taking a lock
+        (see WakeEvent), so that includes the audio thread. If a command is
+        superseded by a later one of the same kind before it's sent, it's
+        skipped.
+
+        The same thread can send latency probes (see setLatencyProbeInterval):
+        readbacks of a register that nothing else asks for, timed from just
+        before sending to the reply's arrival, and kept in a LatencyHistogram.
+        Only one is ever outstanding, so they don't disturb the frames.
+
+        The driver remembers the last angle mode, rate, chirality, compass
+        and travel settings it sent. When it connects again after an unplug,
+        it sends them all at once, and turns the stream back on if it was on.
+
+        Each frame's arrival time is smoothed by a FrameClock, which locks on
+        to the tracker's real frame rate. Feed getAudioClock() from the audio
+        callback, and the smoothed time can be mapped to an audio sample too.
+
+        Consumers that only need the stream some of the time can hold a lease
+        (acquireStream, or a StreamLease) instead of calling turnOn and
+        turnOff. The first lease starts the stream, and it stops a grace
+        period after the last one is released, so an idle driver costs no USB
+        traffic and no decoding, and closing and reopening an editor doesn't
+        make the tracker restart.
+
+        With setAdaptiveRate, a MotionRate watches how fast the head turns,
+        and the sender thread switches the stream between 50Hz and 100Hz to
+        suit.
+
+        When connected to a simulated bootloader, uploadFirmware() streams an
+        image through a FirmwareTransfer. Whichever thread moves the transfer
+        on (the MIDI input thread with an acknowledgement, or the sender
+        thread with a timeout) only queues its blocks: the sender thread
+        sends them. */
+    class TrackerDriver: public MidiDuplex, Tracker::Listener, private juce::Thread,
+        private FirmwareTransfer::Output
     {
     public:
         class Listener
@@ -26,67 +63,227 @@ namespace Midi
 
             /** Called when the head tracker's connection state or its status data is changed */
             virtual void trackerMidiConnectionChanged(Midi::State /*state*/) {}
+
+            /** Called with the first frame after a reconnection restored streaming:
+                the time since connecting, in milliseconds. */
+            virtual void trackerStreamRestored(double /*milliseconds*/) {}
+
+            /** A short name for the listener timing report. */
+            virtual juce::String getListenerName() const { return {}; }
+        };
+
+        /** What a listener can subscribe to: one event for each callback. */
+        enum class Event
+        {
+            Orientation = 0,
+            OrientationQ,
+            OrientationM,
+            CompassState,
+            TrackerConnection,
+            MidiConnection,
+            StreamRestored,
+            NumEvents
         };
 
+        /** Turns events into a mask for addListener: combine them with |. */
+        static constexpr uint32_t eventMask(const Event event)
+        {
+            return 1u << static_cast<int>(event);
+        }
+
+        // eventMask can't be called until the class is complete, so these masks spell it out
+        static constexpr uint32_t AllEvents = (1u << static_cast<int>(Event::NumEvents)) - 1;
+        static constexpr uint32_t OrientationEvents = (1u << static_cast<int>(Event::Orientation)) |
+            (1u << static_cast<int>(Event::OrientationQ)) | (1u << static_cast<int>(Event::OrientationM));
+
+        using ListenerList = SubscriberList<Listener, static_cast<int>(Event::NumEvents)>;
+        using ListenerTiming = ListenerList::Timing;
+
         TrackerDriver() :
             MidiDuplex("Head Tracker MIDI 1", "Supperware Bootloader"),
+            juce::Thread("Head tracker command sender"),
             tracker(this),
+            commands(QueueCapacity),
+            unbankedSends(0),
             currentAngleMode(Tracker::AngleMode::YPR),
             is100Hz(false),
-            isTrackerOn(false)
-        {}
+            isTrackerOn(false),
+            probeInterval(0),
+            probeSentTicks(0),
+            lostProbes(0),
+            nextProbeTime(0),
+            firmwareTransfer(this),
+            framePeriodChange(0),
+            frameTime(0.0),
+            cachedChirality(NotSet),
+            cachedTravelMode(NotSet),
+            cachedCompass(NotSet),
+            connectedMs(0.0),
+            isAwaitingFirstFrame(false),
+            lastRestoreMs(-1.0),
+            numLeases(0),
+            leaseIs100Hz(false),
+            leaseIsQuaternion(true),
+            leaseGraceMs(DefaultLeaseGraceMilliseconds),
+            releaseDeadline(0),
+            isReleasePending(false),
+            isAdaptiveRate(false),
+            wantsFastRate(false),
+            hasPendingWork(false),
+            isSenderWaiting(false)
+        {
+            buildMessageBank();
+            startThread();
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~TrackerDriver()
+        {
+            signalThreadShouldExit();
+            senderWake.signal();
+            stopThread(PollMilliseconds * 20);
+        }
 
         // ------------------------------------------------------------------------
 
         // pass through to our listener
         void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
         {
-            for (Listener* l: listeners)
+            stampFrame();
+            checkRestored();
+            if (isAdaptiveRate)
             {
-                l->trackerOrientation(yawRadian, pitchRadian, rollRadian);
+                motionMatrix.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+                trackMotion();
             }
+            notify(Event::Orientation, [&](Listener* l) { l->trackerOrientation(yawRadian, pitchRadian, rollRadian); });
         }
         void trackerOrientationQ(float qw, float qx, float qy, float qz) override
         {
-            for (Listener* l: listeners)
+            stampFrame();
+            checkRestored();
+            if (isAdaptiveRate)
             {
-                l->trackerOrientationQ(qw, qx, qy, qz);
+                motionMatrix.setOrientationQuaternion(qw, qx, qy, qz);
+                trackMotion();
             }
+            notify(Event::OrientationQ, [&](Listener* l) { l->trackerOrientationQ(qw, qx, qy, qz); });
         }
         void trackerOrientationM(float* matrix) override
         {
-            for (Listener* l: listeners)
+            stampFrame();
+            checkRestored();
+            if (isAdaptiveRate)
             {
-                l->trackerOrientationM(matrix);
+                motionMatrix.setOrientationMatrix(matrix);
+                trackMotion();
             }
+            notify(Event::OrientationM, [&](Listener* l) { l->trackerOrientationM(matrix); });
         }
         void trackerCompassStateChanged(Tracker::CompassState compassState) override
         {
-            for (Listener* l: listeners)
             {
-                l->trackerCompassStateChanged(compassState);
+                const juce::ScopedLock sl(stateLock);
+                state.compassState = compassState;
             }
+            notify(Event::CompassState, [&](Listener* l) { l->trackerCompassStateChanged(compassState); });
         }
-        void trackerConnectionChanged(const Tracker::State& state) override
+        void trackerConnectionChanged(const Tracker::State& trackerState) override
         {
-            for (Listener* l: listeners)
             {
-                l->trackerConnectionChanged(state);
+                // the readback has finished: everything in it is the tracker's own
+                const juce::ScopedLock sl(stateLock);
+                state = trackerState;
             }
+            notify(Event::TrackerConnection, [&](Listener* l) { l->trackerConnectionChanged(trackerState); });
+        }
+        void trackerProbeReceived() override
+        {
+            // a late reply, after its probe was written off, is ignored
+            const int64_t sent = probeSentTicks.exchange(0);
+            if (sent)
+            {
+                const double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - sent);
+                latency.record(static_cast<uint64_t>(seconds * 1e6));
+                wakeSender(); // the next probe may be due before the sender expected
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Subscribes a listener to some of the events (see eventMask), or
+            changes its subscription if it's already listening. Only the
+            subscribed callbacks are made: an OSC sender might ask for
+            eventMask(Event::OrientationQ) alone. This can be called from any
+            thread, even from inside a callback, but it allocates memory. */
+        void addListener(Listener* listener, const uint32_t events = AllEvents)
+        {
+            listeners.add(listener, events);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Can be called from any thread. Once this returns, the listener won't
+            be called again: if another thread is in one of its callbacks, this
+            waits for that call to finish. From inside one of this driver's
+            callbacks, it doesn't wait, so a call to the listener that's already
+            under way on another thread may still be finishing. */
+        void removeListener(Listener* listener)
+        {
+            listeners.remove(listener);
         }
 
         // ------------------------------------------------------------------------
 
-        void addListener(Listener* listener)
+        uint32_t getListenerEvents(Listener* listener) const
         {
-            listeners.push_back(listener);
+            return listeners.getEvents(listener);
         }
 
         // ------------------------------------------------------------------------
 
-        const Tracker::State& getState() const
+        /** Times every listener callback, to find a listener that's holding up
+            the MIDI thread. Calls that take longer than the budget are counted
+            as well. */
+        void setListenerTiming(const bool shouldTime, const int budgetMicroseconds = DefaultListenerBudgetMicroseconds)
+        {
+            listeners.setTiming(shouldTime, static_cast<uint64_t>(juce::jmax(0, budgetMicroseconds)));
+        }
+
+        bool isListenerTiming() const
         {
-            return tracker.getState();
+            return listeners.isTimingCalls();
+        }
+
+        int getListenerBudgetMicroseconds() const
+        {
+            return static_cast<int>(listeners.getBudget());
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Each listener's callback durations since it was added, named by
+            getListenerName (or numbered, if it doesn't say). This allocates. */
+        std::vector<ListenerTiming> getListenerTimings() const
+        {
+            int number = 0;
+            return listeners.getTimings([&number](const Listener* l)
+                {
+                    const juce::String name = l->getListenerName();
+                    ++number;
+                    return name.isEmpty() ? "Listener " + juce::String(number) : name;
+                });
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The tracker's settings as last read back, with any that have been
+            sent since. This is a copy, so it can be called from any thread. */
+        Tracker::State getState() const
+        {
+            const juce::ScopedLock sl(stateLock);
+            return state;
         }
 
         // ------------------------------------------------------------------------
@@ -94,18 +291,18 @@ namespace Midi
         /** Stops sending data, without disconnecting. */
         void turnOff()
         {
-            if (isTrackerOn)
+            if (isTrackerOn.exchange(false))
             {
-                isTrackerOn = false;
-                size_t numBytes = tracker.turnOffMessage(midiBuffer);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                setExpectedTrafficInterval(0);
+                post(TrackerCommand::Type::TurnOff);
             }
         }
 
         // ------------------------------------------------------------------------
 
         /** If set100Hz is false, the tracker responds at 50Hz.
-            These settings are remembered if you enable setAutoDisconnect / setAutoReconnect. */
+            These settings are remembered, and restored whenever the tracker reconnects.
+            This connects first if necessary, which isn't safe on the audio thread. */
         void turnOn(bool is100HzMode = false, bool isQuaternionMode = true)
         {
             if (connectionState != State::Connected)
@@ -113,15 +310,117 @@ namespace Midi
                 connect();
             }
 
-            currentAngleMode = isQuaternionMode ? Tracker::AngleMode::Quaternion : Tracker::AngleMode::YPR;
+            const Tracker::AngleMode angleMode = isQuaternionMode ? Tracker::AngleMode::Quaternion : Tracker::AngleMode::YPR;
+            currentAngleMode = angleMode;
 
             if (connectionState == State::Connected)
             {
                 is100Hz = is100HzMode;
                 isTrackerOn = true;
-                size_t numBytes = tracker.turnOnMessage(midiBuffer, currentAngleMode, is100Hz);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                setExpectedTrafficInterval(is100HzMode ? 10 : 20);
+                framePeriodChange = is100HzMode ? 10000 : 20000;
+                post(TrackerCommand::Type::TurnOn, static_cast<uint8_t>(angleMode), is100HzMode ? 1 : 0);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Takes a lease on the stream. The first lease turns the tracker on
+            with these settings (connecting first if necessary, so not from
+            the audio thread), or cancels a pending release; later leases
+            share the stream as it is. If the tracker isn't connected yet, it's
+            turned on when it is. Don't mix leases with turnOn and turnOff. */
+        void acquireStream(const bool is100HzMode = false, const bool isQuaternionMode = true)
+        {
+            const juce::ScopedLock sl(leaseLock);
+            isReleasePending = false;
+            if (numLeases++ == 0)
+            {
+                leaseIs100Hz = is100HzMode;
+                leaseIsQuaternion = isQuaternionMode;
+            }
+            if (!isTrackerOn)
+            {
+                turnOn(leaseIs100Hz, leaseIsQuaternion);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Gives a lease back. When the last one goes, the stream is turned off
+            after the grace period, unless another lease is taken first. */
+        void releaseStream()
+        {
+            {
+                const juce::ScopedLock sl(leaseLock);
+                jassert(numLeases > 0);
+                if ((numLeases == 0) || (--numLeases > 0))
+                {
+                    return;
+                }
+                releaseDeadline = juce::Time::getMillisecondCounter() + static_cast<uint32_t>(leaseGraceMs.load());
+                isReleasePending = true;
+            }
+            wakeSender();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Holds a lease on a driver's stream for as long as it exists. */
+        class StreamLease
+        {
+        public:
+            StreamLease(TrackerDriver& trackerDriver, const bool is100HzMode = false, const bool isQuaternionMode = true) :
+                td(trackerDriver)
+            {
+                td.acquireStream(is100HzMode, isQuaternionMode);
+            }
+
+            ~StreamLease()
+            {
+                td.releaseStream();
             }
+
+        private:
+            TrackerDriver& td;
+            JUCE_DECLARE_NON_COPYABLE(StreamLease)
+        };
+
+        // ------------------------------------------------------------------------
+
+        int getNumStreamLeases() const
+        {
+            const juce::ScopedLock sl(leaseLock);
+            return numLeases;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** How long the stream stays on after the last lease is released. */
+        void setStreamGracePeriod(const int milliseconds)
+        {
+            leaseGraceMs = juce::jmax(0, milliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Lets the head's motion choose the frame rate: 100Hz while it turns
+            quickly, 50Hz while it's still. The stream starts at the rate given
+            to turnOn. Turning this off leaves the rate where it is. */
+        void setAdaptiveRate(const bool shouldAdapt)
+        {
+            wantsFastRate = is100Hz.load();
+            isAdaptiveRate = shouldAdapt;
+            wakeSender();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The adaptive rate's speed and its time spent at each rate. These can
+            be read from any thread. */
+        const MotionRate& getMotionRate() const
+        {
+            return motionRate;
         }
 
         // ------------------------------------------------------------------------
@@ -129,8 +428,7 @@ namespace Midi
         /** Centres the head tracker. */
         void zero()
         {
-            size_t numBytes = tracker.zeroMessage(midiBuffer);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            post(TrackerCommand::Type::Zero);
         }
 
         // ------------------------------------------------------------------------
@@ -138,8 +436,8 @@ namespace Midi
         /** Determines whether the cable should be over the left or right ear. */
         void setChirality(const bool isRightEarChirality)
         {
-            size_t numBytes = tracker.chiralityMessage(midiBuffer, isRightEarChirality);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            cachedChirality = isRightEarChirality ? 1 : 0;
+            post(TrackerCommand::Type::Chirality, isRightEarChirality ? 1 : 0);
         }
         
         // ------------------------------------------------------------------------
@@ -147,8 +445,8 @@ namespace Midi
         /** Automatic zeroing modes (work only when the compass is off). */
         void setTravelMode(const Tracker::TravelMode newTravelMode)
         {
-            size_t numBytes = tracker.travelModeMessage(midiBuffer, newTravelMode);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            cachedTravelMode = static_cast<int>(newTravelMode);
+            post(TrackerCommand::Type::TravelMode, static_cast<uint8_t>(newTravelMode));
         }
 
         // ------------------------------------------------------------------------
@@ -157,8 +455,8 @@ namespace Midi
             This state can be read back with getCompassState(). */
         void setCompass(bool compassShouldBeOn, bool compassShouldApplyYawCorrection)
         {
-            size_t numBytes = tracker.compassMessage(midiBuffer, compassShouldBeOn, compassShouldApplyYawCorrection);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            cachedCompass = (compassShouldBeOn ? 1 : 0) | (compassShouldApplyYawCorrection ? 2 : 0);
+            post(TrackerCommand::Type::Compass, compassShouldBeOn ? 1 : 0, compassShouldApplyYawCorrection ? 1 : 0);
         }
         
         // ------------------------------------------------------------------------
@@ -166,8 +464,167 @@ namespace Midi
         /** Put compass in calibration mode. */
         void calibrateCompass()
         {
-            size_t numBytes = tracker.calibrateCompassMessage(midiBuffer);
-            sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            post(TrackerCommand::Type::CalibrateCompass);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sends a latency probe every intervalMilliseconds while connected, or
+            stops them if it's 0. Once a second is plenty for monitoring a link. */
+        void setLatencyProbeInterval(const int intervalMilliseconds)
+        {
+            probeInterval = juce::jmax(0, intervalMilliseconds);
+            wakeSender();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Round trip times, host to head tracker to host, in microseconds. */
+        const LatencyHistogram& getLatencyHistogram() const
+        {
+            return latency;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Probes that weren't answered within ProbeTimeoutMilliseconds. */
+        uint64_t getLostProbes() const
+        {
+            return lostProbes;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** How long the last reconnection took to bring the stream back, from
+            connecting to the first frame, in milliseconds; or -1 if there hasn't
+            been one. With setAutoReconnect, connection follows a replug as soon
+            as it's noticed. */
+        double getLastRestoreMilliseconds() const
+        {
+            return lastRestoreMs;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** During an orientation callback: when the frame really arrived, in
+            seconds on juce::Time::getMillisecondCounterHiRes's clock, with the
+            jitter filtered out. */
+        double getFrameTime() const
+        {
+            return frameTime;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** During an orientation callback: the audio sample, as counted by
+            getAudioClock(), at which the frame arrived; or -1 if the audio
+            clock isn't being fed. */
+        double getFrameAudioSample() const
+        {
+            return audioClock.hostToSample(frameTime);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Call audioBlock() on this at the start of every audio callback, with
+            juce::Time::getMillisecondCounterHiRes() * 0.001, to put frames on
+            the audio sample clock. */
+        AudioClock& getAudioClock()
+        {
+            return audioClock;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** The frame clock's state. Only read it from an orientation callback. */
+        const FrameClock& getFrameClock() const
+        {
+            return frameClock;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** During an orientation callback: fills in a frame's arrival times, on
+            every clock that the driver knows. */
+        void timestampFrame(OrientationFrame& frame) const
+        {
+            frame.arrivalMs = juce::Time::getMillisecondCounterHiRes();
+            frame.sampleTime = getMessageSampleTime();
+            frame.smoothedMs = frameTime * 1000.0;
+            frame.audioSample = getFrameAudioSample();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Starts sending a firmware image to a bootloader on a LoopbackPort,
+            such as a SimulatedTracker in bootloader mode. FirmwareTransfer's
+            block format is this library's own, not the one Supperware's
+            bootloader expects, so nothing is ever sent to a real device:
+            this returns false unless a loopback bootloader is connected, and
+            also if an upload is already under way. The listener is called on
+            the MIDI input thread or the sender thread. This copies the image,
+            so allocates memory. */
+        bool uploadFirmware(const uint8_t* image, const size_t numBytes, FirmwareTransfer::Listener* listener,
+            const FirmwareTransfer::Settings& settings = FirmwareTransfer::Settings())
+        {
+            const juce::ScopedLock sl(transferLock);
+            if ((connectionState != State::Bootloader) || !loopback || firmwareTransfer.isActive())
+            {
+                return false;
+            }
+
+            // room for two windows' worth of blocks, and Begin and End
+            const FirmwareTransfer::Settings rounded = FirmwareTransfer::roundSettings(settings);
+            transferBytes.clear();
+            transferBytes.reserve((rounded.windowBlocks * 2 + 2) * FirmwareTransfer::getBlockMessageBytes(rounded.blockBytes));
+            firmwareTransfer.setListener(listener);
+            firmwareTransfer.advanceTo(juce::Time::getMillisecondCounterHiRes() * 0.001);
+            firmwareTransfer.start(image, numBytes, settings);
+            wakeSender();
+            return true;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void cancelFirmwareUpload()
+        {
+            const juce::ScopedLock sl(transferLock);
+            firmwareTransfer.cancel();
+            transferBytes.clear();
+        }
+
+        // ------------------------------------------------------------------------
+
+        FirmwareTransfer::State getFirmwareUploadState() const
+        {
+            const juce::ScopedLock sl(transferLock);
+            return firmwareTransfer.getState();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** From 0 to 1: the proportion of the image acknowledged so far. */
+        float getFirmwareUploadProgress() const
+        {
+            const juce::ScopedLock sl(transferLock);
+            return firmwareTransfer.getProgress();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Commands that couldn't be sent because the queue was full. */
+        uint64_t getDroppedCommands() const
+        {
+            return commands.getDroppedCommands();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Commands that weren't in the message bank, so had to allocate a
+            message on the sender thread. This should stay at 0. */
+        uint64_t getUnbankedSends() const
+        {
+            return unbankedSends;
         }
 
         // ------------------------------------------------------------------------
@@ -179,7 +636,7 @@ namespace Midi
 
         void handleSysEx(const uint8_t* data, const size_t numBytes) override
         {
-            if (!tracker.processSysex(data, numBytes))
+            if (!tracker.processSysex(data, numBytes) && !processTransferSysex(data, numBytes))
             {
                 handleOtherSysEx(data, numBytes);
             }
@@ -191,24 +648,517 @@ namespace Midi
         {
             if (connectionState == State::Connected)
             {
-                size_t numBytes = tracker.readbackMessage(midiBuffer);
-                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+                // the readback comes last in the restore sequence
+                connectedMs = juce::Time::getMillisecondCounterHiRes();
+                resumeLeasedStream();
+                isAwaitingFirstFrame = isTrackerOn.load();
+                post(TrackerCommand::Type::Restore);
             }
-            for (Listener* l: listeners)
+            if (connectionState != State::Bootloader)
             {
-                l->trackerMidiConnectionChanged(connectionState);
+                cancelFirmwareUpload();
             }
+            notify(Event::MidiConnection, [&](Listener* l) { l->trackerMidiConnectionChanged(connectionState); });
         }
 
         // ------------------------------------------------------------------------
 
     private:
-        std::vector<Listener*> listeners;
-        Tracker tracker;
+        static constexpr size_t QueueCapacity = 64;
+        static constexpr int PollMilliseconds = 5;
+        static constexpr int ProbeTimeoutMilliseconds = 1000;
+        static constexpr int DefaultLeaseGraceMilliseconds = 2000;
+        static constexpr int DefaultListenerBudgetMicroseconds = 500;
+
+        ListenerList listeners;
+        Tracker tracker; // parses, on the MIDI input thread
+        Tracker formatter; // formats commands, on the sender thread; its state isn't used
+        juce::CriticalSection stateLock;
+        Tracker::State state; // guarded by stateLock
         juce::Vector3D<float> position;
-        uint8_t midiBuffer[16];
-        Tracker::AngleMode currentAngleMode;
-        bool is100Hz;
-        bool isTrackerOn;
+        CommandQueue commands;
+        MessageBank messageBank;
+        std::atomic<uint64_t> unbankedSends;
+        uint8_t midiBuffer[16]; // only touched by the sender thread
+        // written by turnOn, the lease and adaptive rate code on their own threads
+        std::atomic<Tracker::AngleMode> currentAngleMode;
+        std::atomic<bool> is100Hz;
+        std::atomic<bool> isTrackerOn;
+        LatencyHistogram latency;
+        std::atomic<int> probeInterval;
+        std::atomic<int64_t> probeSentTicks; // 0 when no probe is outstanding
+        std::atomic<uint64_t> lostProbes;
+        uint32_t nextProbeTime; // only touched by the sender thread
+        juce::CriticalSection transferLock;
+        FirmwareTransfer firmwareTransfer;
+        std::vector<uint8_t> transferBytes; // guarded by transferLock: messages waiting to be sent
+        std::vector<uint8_t> sendingBytes; // only touched by the sender thread
+        FrameClock frameClock; // only touched by the MIDI input thread
+        AudioClock audioClock;
+        std::atomic<int> framePeriodChange; // microseconds, or 0
+        double frameTime;
+        static constexpr int NotSet = -1;
+        std::atomic<int> cachedChirality, cachedTravelMode, cachedCompass;
+        std::atomic<double> connectedMs;
+        std::atomic<bool> isAwaitingFirstFrame;
+        std::atomic<double> lastRestoreMs;
+        juce::CriticalSection leaseLock;
+        int numLeases; // guarded by leaseLock, like the three below
+        bool leaseIs100Hz, leaseIsQuaternion;
+        std::atomic<int> leaseGraceMs;
+        uint32_t releaseDeadline;
+        bool isReleasePending;
+        std::atomic<bool> isAdaptiveRate, wantsFastRate;
+        MotionRate motionRate; // updated only on the MIDI input thread
+        HeadMatrix motionMatrix;
+        std::atomic<bool> hasPendingWork, isSenderWaiting;
+        WakeEvent senderWake;
+
+        // ------------------------------------------------------------------------
+
+        template <typename Function>
+        void notify(const Event event, Function function)
+        {
+            listeners.call(static_cast<int>(event), function);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void post(const TrackerCommand::Type type, const uint8_t arg0 = 0, const uint8_t arg1 = 0)
+        {
+            commands.push({ type, arg0, arg1 });
+            wakeSender();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Call after giving the sender work of any kind. The work is flagged,
+            and then the sender's event is signalled if it's asleep, or about to
+            be. run() clears the flag before it looks for work, and checks it
+            again after saying it's about to sleep, so either it sees the flag,
+            or this sees that it's waiting. */
+        void wakeSender()
+        {
+            hasPendingWork.store(true);
+            if (isSenderWaiting.load())
+            {
+                senderWake.signal();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void run() override
+        {
+            // Between commands, this sleeps until the next probe or lease
+            // deadline, or indefinitely; anything that gives it work wakes it.
+            TrackerCommand batch[QueueCapacity];
+            while (!threadShouldExit())
+            {
+                // an exchange, so that the work flagged before it is visible below
+                hasPendingWork.exchange(false);
+                size_t numCommands = 0;
+                while ((numCommands < QueueCapacity) && commands.pop(batch[numCommands]))
+                {
+                    ++numCommands;
+                }
+                for (size_t i = 0; i < numCommands; ++i)
+                {
+                    if (!isSuperseded(batch, i, numCommands))
+                    {
+                        sendCommand(batch[i]);
+                    }
+                }
+                serviceProbe();
+                serviceTransfer();
+                serviceLeases();
+                serviceAdaptiveRate();
+                if (numCommands == 0)
+                {
+                    isSenderWaiting.store(true);
+                    if (!hasPendingWork.load())
+                    {
+                        senderWake.wait(getIdleMilliseconds());
+                    }
+                    isSenderWaiting.store(false);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** How long the sender can sleep before a probe or a lease is due, or
+            -1 if nothing is. A firmware transfer keeps it polling. */
+        int getIdleMilliseconds()
+        {
+            {
+                const juce::ScopedLock sl(transferLock);
+                if (firmwareTransfer.isActive())
+                {
+                    return PollMilliseconds;
+                }
+            }
+
+            const uint32_t now = juce::Time::getMillisecondCounter();
+            int32_t ms = -1;
+            auto until = [&ms, now](const uint32_t deadline)
+            {
+                const int32_t remaining = juce::jmax(1, static_cast<int32_t>(deadline - now));
+                ms = (ms < 0) ? remaining : juce::jmin(ms, remaining);
+            };
+
+            const int64_t sent = probeSentTicks;
+            if (sent)
+            {
+                const double elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - sent) * 1000.0;
+                until(now + static_cast<uint32_t>(juce::jmax(0.0, ProbeTimeoutMilliseconds - elapsed)) + 1);
+            }
+            else if ((probeInterval > 0) && (connectionState == State::Connected))
+            {
+                until(nextProbeTime);
+            }
+            {
+                const juce::ScopedLock sl(leaseLock);
+                if (isReleasePending)
+                {
+                    until(releaseDeadline);
+                }
+            }
+            return static_cast<int>(ms);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void stampFrame()
+        {
+            const int newPeriod = framePeriodChange.exchange(0);
+            if (newPeriod)
+            {
+                frameClock.reset(newPeriod * 1e-6);
+            }
+            frameTime = frameClock.update(juce::Time::getMillisecondCounterHiRes() * 0.001);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void checkRestored()
+        {
+            if (isAwaitingFirstFrame.exchange(false))
+            {
+                const double ms = juce::Time::getMillisecondCounterHiRes() - connectedMs;
+                lastRestoreMs = ms;
+                notify(Event::StreamRestored, [&](Listener* l) { l->trackerStreamRestored(ms); });
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void trackMotion()
+        {
+            const bool fast = motionRate.update(motionMatrix, frameTime);
+            if (wantsFastRate.exchange(fast) != fast)
+            {
+                wakeSender();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sends the setup again with a new rate when the motion asks for it.
+            The angle mode stays as it is. */
+        void serviceAdaptiveRate()
+        {
+            const bool fast = wantsFastRate;
+            if (isAdaptiveRate && isTrackerOn && (connectionState == State::Connected) && (fast != is100Hz))
+            {
+                is100Hz = fast;
+                setExpectedTrafficInterval(fast ? 10 : 20);
+                framePeriodChange = fast ? 10000 : 20000;
+                sendCommand({ TrackerCommand::Type::TurnOn, static_cast<uint8_t>(currentAngleMode.load()), static_cast<uint8_t>(fast ? 1 : 0) });
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Turns the stream off once the last lease's grace period is over. */
+        void serviceLeases()
+        {
+            const juce::ScopedLock sl(leaseLock);
+            if (isReleasePending && (static_cast<int32_t>(juce::Time::getMillisecondCounter() - releaseDeadline) >= 0))
+            {
+                isReleasePending = false;
+                turnOff();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** If there are leases, but turnOn couldn't start the stream because the
+            tracker wasn't connected, marks the stream on now so that the restore
+            sequence starts it. */
+        void resumeLeasedStream()
+        {
+            const juce::ScopedLock sl(leaseLock);
+            if ((numLeases > 0) && !isTrackerOn)
+            {
+                currentAngleMode = leaseIsQuaternion ? Tracker::AngleMode::Quaternion : Tracker::AngleMode::YPR;
+                is100Hz = leaseIs100Hz;
+                isTrackerOn = true;
+                setExpectedTrafficInterval(leaseIs100Hz ? 10 : 20);
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Sends everything that was set before the connection dropped, back to
+            back, with the stream last (so that its first frame is already in the
+            right form) and a readback after that. */
+        void sendRestore()
+        {
+            const int chirality = cachedChirality;
+            const int travelMode = cachedTravelMode;
+            const int compass = cachedCompass;
+            if (chirality != NotSet)
+            {
+                sendCommand({ TrackerCommand::Type::Chirality, static_cast<uint8_t>(chirality), 0 });
+            }
+            if (travelMode != NotSet)
+            {
+                sendCommand({ TrackerCommand::Type::TravelMode, static_cast<uint8_t>(travelMode), 0 });
+            }
+            if (compass != NotSet)
+            {
+                sendCommand({ TrackerCommand::Type::Compass, static_cast<uint8_t>(compass & 1), static_cast<uint8_t>(compass >> 1) });
+            }
+            if (isTrackerOn)
+            {
+                const bool fast = is100Hz;
+                framePeriodChange = fast ? 10000 : 20000;
+                sendCommand({ TrackerCommand::Type::TurnOn, static_cast<uint8_t>(currentAngleMode.load()), static_cast<uint8_t>(fast ? 1 : 0) });
+            }
+            sendCommand({ TrackerCommand::Type::Readback, 0, 0 });
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Writes off an unanswered probe, and sends the next one when it's due. */
+        void serviceProbe()
+        {
+            const uint32_t now = juce::Time::getMillisecondCounter();
+            const int64_t sent = probeSentTicks;
+            if (sent && (juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - sent) * 1000.0 > ProbeTimeoutMilliseconds))
+            {
+                if (probeSentTicks.exchange(0))
+                {
+                    ++lostProbes;
+                }
+            }
+
+            const int interval = probeInterval;
+            if ((interval > 0) && (connectionState == State::Connected) && !probeSentTicks &&
+                (static_cast<int32_t>(now - nextProbeTime) >= 0))
+            {
+                nextProbeTime = now + static_cast<uint32_t>(interval);
+                sendCommand({ TrackerCommand::Type::Probe, 0, 0 });
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Checks the transfer's timeouts, and sends whatever it has queued.
+            The messages are copied out, so that they're sent without holding
+            transferLock, and the MIDI input thread is never kept waiting. The
+            copy allocates once per upload, the first time round. */
+        void serviceTransfer()
+        {
+            {
+                const juce::ScopedLock sl(transferLock);
+                if (firmwareTransfer.isActive())
+                {
+                    firmwareTransfer.advanceTo(juce::Time::getMillisecondCounterHiRes() * 0.001);
+                }
+                if (transferBytes.empty())
+                {
+                    return;
+                }
+                if (sendingBytes.capacity() < transferBytes.capacity())
+                {
+                    sendingBytes.reserve(transferBytes.capacity());
+                }
+                sendingBytes.assign(transferBytes.begin(), transferBytes.end());
+                transferBytes.clear();
+            }
+
+            // each message ends with the only 0xF7 in it
+            size_t start = 0;
+            for (size_t i = 0; i < sendingBytes.size(); ++i)
+            {
+                if (sendingBytes[i] == 0xf7)
+                {
+                    sendMessage(sendingBytes.data() + start, i + 1 - start);
+                    start = i + 1;
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        bool processTransferSysex(const uint8_t* data, const size_t numBytes)
+        {
+            const juce::ScopedLock sl(transferLock);
+            return firmwareTransfer.processSysex(data, numBytes);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Called with transferLock held, on the MIDI input thread or the
+            sender thread: queues the message for the sender thread. If the
+            queue is full, the message is dropped, as if the link had lost it,
+            and the transfer's timeout sends it again. */
+        void firmwareSysex(const uint8_t* data, const size_t numBytes) override
+        {
+            if (transferBytes.size() + numBytes <= transferBytes.capacity())
+            {
+                transferBytes.insert(transferBytes.end(), data, data + numBytes);
+                wakeSender();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Every command the driver can send is built here, so that sending
+            never allocates. */
+        void buildMessageBank()
+        {
+            uint8_t buffer[16];
+            const Tracker::UpdateMode noUpdate = Tracker::UpdateMode::DontUpdateState;
+            for (uint8_t mode = 0; mode < 3; ++mode)
+            {
+                messageBank.add(buffer, formatter.turnOnMessage(buffer, static_cast<Tracker::AngleMode>(mode), false));
+                messageBank.add(buffer, formatter.turnOnMessage(buffer, static_cast<Tracker::AngleMode>(mode), true));
+            }
+            messageBank.add(buffer, formatter.turnOffMessage(buffer));
+            messageBank.add(buffer, formatter.zeroMessage(buffer));
+            messageBank.add(buffer, formatter.chiralityMessage(buffer, false, noUpdate));
+            messageBank.add(buffer, formatter.chiralityMessage(buffer, true, noUpdate));
+            messageBank.add(buffer, formatter.travelModeMessage(buffer, Tracker::TravelMode::Off, noUpdate));
+            messageBank.add(buffer, formatter.travelModeMessage(buffer, Tracker::TravelMode::Slow, noUpdate));
+            messageBank.add(buffer, formatter.travelModeMessage(buffer, Tracker::TravelMode::Fast, noUpdate));
+            for (uint8_t i = 0; i < 4; ++i)
+            {
+                messageBank.add(buffer, formatter.compassMessage(buffer, (i & 1) != 0, (i & 2) != 0, noUpdate));
+            }
+            messageBank.add(buffer, formatter.calibrateCompassMessage(buffer));
+            messageBank.add(buffer, formatter.readbackMessage(buffer));
+            messageBank.add(buffer, formatter.probeMessage(buffer));
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** A setting shows in getState() as soon as it's sent, rather than when
+            it's next read back. */
+        void updateState(const TrackerCommand& command)
+        {
+            const bool isSetting = (command.type == TrackerCommand::Type::Chirality) ||
+                (command.type == TrackerCommand::Type::TravelMode) || (command.type == TrackerCommand::Type::Compass);
+            if (!isSetting)
+            {
+                return;
+            }
+
+            const juce::ScopedLock sl(stateLock);
+            switch (command.type)
+            {
+            case TrackerCommand::Type::Chirality:
+                state.rightEarChirality = command.arg0 != 0;
+                break;
+            case TrackerCommand::Type::TravelMode:
+                state.travelMode = static_cast<Tracker::TravelMode>(command.arg0);
+                break;
+            default:
+                state.compassOn = command.arg0 != 0;
+                state.compassSlowCorrection = command.arg1 != 0;
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        static bool isSuperseded(const TrackerCommand* batch, const size_t index, const size_t numCommands)
+        {
+            const uint8_t key = batch[index].getCoalescingKey();
+            for (size_t i = index + 1; i < numCommands; ++i)
+            {
+                if (batch[i].getCoalescingKey() == key)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // ------------------------------------------------------------------------
+
+        void sendCommand(const TrackerCommand& command)
+        {
+            const Tracker::UpdateMode noUpdate = Tracker::UpdateMode::DontUpdateState;
+            size_t numBytes;
+            switch (command.type)
+            {
+            case TrackerCommand::Type::Restore:
+                sendRestore();
+                return;
+            case TrackerCommand::Type::TurnOn:
+                numBytes = formatter.turnOnMessage(midiBuffer, static_cast<Tracker::AngleMode>(command.arg0), command.arg1 != 0);
+                break;
+            case TrackerCommand::Type::TurnOff:
+                numBytes = formatter.turnOffMessage(midiBuffer);
+                break;
+            case TrackerCommand::Type::Zero:
+                numBytes = formatter.zeroMessage(midiBuffer);
+                break;
+            case TrackerCommand::Type::Chirality:
+                numBytes = formatter.chiralityMessage(midiBuffer, command.arg0 != 0, noUpdate);
+                break;
+            case TrackerCommand::Type::TravelMode:
+                numBytes = formatter.travelModeMessage(midiBuffer, static_cast<Tracker::TravelMode>(command.arg0), noUpdate);
+                break;
+            case TrackerCommand::Type::Compass:
+                numBytes = formatter.compassMessage(midiBuffer, command.arg0 != 0, command.arg1 != 0, noUpdate);
+                break;
+            case TrackerCommand::Type::CalibrateCompass:
+                numBytes = formatter.calibrateCompassMessage(midiBuffer);
+                break;
+            case TrackerCommand::Type::Probe:
+                numBytes = formatter.probeMessage(midiBuffer);
+                break;
+            default:
+                numBytes = formatter.readbackMessage(midiBuffer);
+            }
+            updateState(command);
+
+            const juce::MidiMessage* message = messageBank.find(midiBuffer, numBytes);
+            if (command.type == TrackerCommand::Type::Probe)
+            {
+                // as late as possible, so that only the link is timed
+                probeSentTicks = juce::Time::getHighResolutionTicks();
+            }
+            if (message)
+            {
+                sendMessage(*message);
+            }
+            else
+            {
+                // every command should be in the bank: this one allocates
+                jassertfalse;
+                unbankedSends.fetch_add(1, std::memory_order_relaxed);
+                sendMessage(juce::MidiMessage(midiBuffer, (int)numBytes));
+            }
+        }
     };
+
+    // ----------------------------------------------------------------------------
+
+    static_assert(TrackerDriver::OrientationEvents == (TrackerDriver::eventMask(TrackerDriver::Event::Orientation) |
+        TrackerDriver::eventMask(TrackerDriver::Event::OrientationQ) | TrackerDriver::eventMask(TrackerDriver::Event::OrientationM)),
+        "OrientationEvents should be the three orientation events");
 };
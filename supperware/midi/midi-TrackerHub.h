@@ -0,0 +1,54 @@
+/*
+ * MIDI drivers
+ * One head tracker connection for the whole process, shared by every plugin instance
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Owns the process's one TrackerDriver: its device connection, enumeration
+        timer, sender thread and decoding. Hold it through a
+        juce::SharedResourcePointer<TrackerHub> (or SharedTrackerHub): the
+        first pointer creates it, and it's destroyed when the last one goes,
+        so several plugin instances in one host open the device once and
+        decode each frame once, however many of them there are.
+
+        Each instance then subscribes as it would to a driver of its own: a
+        TrackerDriver::Listener (perhaps through a QueuedListener or a
+        BatchedListener), removed before the instance goes away, and a
+        stream lease (see TrackerDriver::acquireStream) rather than turnOn and
+        turnOff, so that one instance can't stop the stream under another.
+        Disconnecting affects every instance, so it's best left to the last
+        one holding a lease. */
+    class TrackerHub
+    {
+    public:
+        TrackerHub()
+        {}
+
+        // ------------------------------------------------------------------------
+
+        TrackerDriver& getDriver()
+        {
+            return driver;
+        }
+
+        const TrackerDriver& getDriver() const
+        {
+            return driver;
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        TrackerDriver driver;
+
+        JUCE_DECLARE_NON_COPYABLE(TrackerHub)
+    };
+
+    // ----------------------------------------------------------------------------
+
+    using SharedTrackerHub = juce::SharedResourcePointer<TrackerHub>;
+};
@@ -0,0 +1,345 @@
+/*
+ * MIDI drivers
+ * Finds every head tracker on the system, and drives them all
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+namespace Midi
+{
+    /** Keeps one TrackerDriver and one HeadMatrix for every head tracker that
+        has been plugged in since it was created. Each device is identified
+        by the identifier of its MIDI input port (which, depending on the
+        platform, is its USB path or its sequencer address), and keeps the same
+        index for the registry's lifetime: if a tracker is unplugged and comes
+        back with the same identifier, it gets its old index back.
+
+        To follow one device, add a TrackerDriver::Listener to getDriver(index).
+        To follow them all, add a TrackerRegistry::Listener here. Devices are
+        added on the message thread, and apart from adding and removing
+        listeners, the registry's methods must be called there too (debug
+        builds check). Orientation callbacks arrive on each device's MIDI
+        thread, and connection callbacks on the message thread. The HeadMatrix
+        that each device keeps is written on its MIDI thread, so the registry
+        only hands out copies of it. */
+    class TrackerRegistry : private juce::Timer, private DeviceWatcher::Listener
+    {
+    public:
+        class Listener
+        {
+        public:
+            virtual ~Listener() {};
+
+            /** A head tracker has been seen for the first time. */
+            virtual void trackerDeviceAdded(int /*deviceIndex*/) {}
+            /** A device's HeadMatrix has been updated. */
+            virtual void trackerDeviceOrientation(int /*deviceIndex*/, const HeadMatrix& /*headMatrix*/) {}
+            virtual void trackerDeviceConnectionChanged(int /*deviceIndex*/, Midi::State /*state*/) {}
+        };
+
+        // ------------------------------------------------------------------------
+
+        TrackerRegistry(const juce::String trackerName = "Head Tracker MIDI 1") :
+            deviceName(trackerName),
+            is100Hz(false),
+            isQuaternionMode(true),
+            isStreaming(false),
+            devicesHaveChanged(false)
+        {
+            deviceWatcher->addListener(this);
+            refresh();
+            startTimer(deviceWatcher->isWatching() ? FallbackPollMilliseconds : PollMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        ~TrackerRegistry()
+        {
+            deviceWatcher->removeListener(this);
+            stopTimer();
+            for (std::unique_ptr<Device>& d : devices)
+            {
+                d->driver.removeListener(d.get());
+                d->driver.disconnect();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Listeners are called on the message thread and on every device's
+            MIDI thread, so these can be called from any thread, and the list
+            is read without locking (see SubscriberList). */
+        void addListener(Listener* listener)
+        {
+            listeners.add(listener, 1);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Once this returns, the listener won't be called again. */
+        void removeListener(Listener* listener)
+        {
+            listeners.remove(listener);
+        }
+
+        // ------------------------------------------------------------------------
+
+        int getNumDevices() const
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            return static_cast<int>(devices.size());
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Returns the index of the device with this identifier, or -1. */
+        int findDevice(const juce::String& identifier) const
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            return indices.contains(identifier) ? indices[identifier] : -1;
+        }
+
+        // ------------------------------------------------------------------------
+
+        const juce::String& getIdentifier(const int deviceIndex) const
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            return devices[static_cast<size_t>(deviceIndex)]->identifier;
+        }
+
+        // ------------------------------------------------------------------------
+
+        TrackerDriver& getDriver(const int deviceIndex)
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            return devices[static_cast<size_t>(deviceIndex)]->driver;
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Copies a device's latest orientation. The MIDI thread only holds
+            the lock while it updates the matrix, so this never waits long. */
+        void getHeadMatrix(const int deviceIndex, HeadMatrix& destination) const
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            const Device& d = *devices[static_cast<size_t>(deviceIndex)];
+            const juce::SpinLock::ScopedLockType sl(d.matrixLock);
+            destination.setOrientationMatrix(d.headMatrix.getMatrix());
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Turns on every connected head tracker, and any that connect later. */
+        void turnOnAll(const bool is100HzMode = false, const bool quaternionMode = true)
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            is100Hz = is100HzMode;
+            isQuaternionMode = quaternionMode;
+            isStreaming = true;
+            for (std::unique_ptr<Device>& d : devices)
+            {
+                if (d->driver.getConnectionState() == State::Connected)
+                {
+                    d->driver.turnOn(is100Hz, isQuaternionMode);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        void turnOffAll()
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            isStreaming = false;
+            for (std::unique_ptr<Device>& d : devices)
+            {
+                d->driver.turnOff();
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Looks for devices that haven't been seen before. This happens by
+            itself when MIDI devices change, so it rarely needs calling. */
+        void refresh()
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            const juce::Array<juce::MidiDeviceInfo> inInfo = juce::MidiInput::getAvailableDevices();
+            const juce::Array<juce::MidiDeviceInfo> outInfo = juce::MidiOutput::getAvailableDevices();
+
+            // Inputs and outputs are paired by identifier where the platform
+            // gives both ends the same one, and otherwise in the order listed.
+            std::vector<bool> isOutputUsed(static_cast<size_t>(outInfo.size()), false);
+            for (const juce::MidiDeviceInfo& input : inInfo)
+            {
+                if (!isTrackerName(input.name))
+                {
+                    continue;
+                }
+                int output = -1;
+                for (int i = 0; (i < outInfo.size()) && (output < 0); ++i)
+                {
+                    if (!isOutputUsed[static_cast<size_t>(i)] && (outInfo[i].identifier == input.identifier))
+                    {
+                        output = i;
+                    }
+                }
+                for (int i = 0; (i < outInfo.size()) && (output < 0); ++i)
+                {
+                    if (!isOutputUsed[static_cast<size_t>(i)] && isTrackerName(outInfo[i].name))
+                    {
+                        output = i;
+                    }
+                }
+                if (output < 0)
+                {
+                    continue;
+                }
+                isOutputUsed[static_cast<size_t>(output)] = true;
+
+                if (!indices.contains(input.identifier))
+                {
+                    addDevice(input.identifier, outInfo[output].identifier);
+                }
+            }
+        }
+
+        // ------------------------------------------------------------------------
+
+    private:
+        static constexpr int PollMilliseconds = 1000;
+        static constexpr int FallbackPollMilliseconds = 5000;
+
+        /** One head tracker: its driver, its orientation, and a listener that
+            passes its callbacks on to the registry's listeners. */
+        class Device : public TrackerDriver::Listener
+        {
+        public:
+            Device(TrackerRegistry& trackerRegistry, const int deviceIndex, const juce::String& deviceIdentifier) :
+                registry(trackerRegistry),
+                index(deviceIndex),
+                identifier(deviceIdentifier)
+            {}
+
+            void trackerOrientation(float yawRadian, float pitchRadian, float rollRadian) override
+            {
+                {
+                    const juce::SpinLock::ScopedLockType sl(matrixLock);
+                    headMatrix.setOrientationYPR(yawRadian, pitchRadian, rollRadian);
+                }
+                registry.notifyOrientation(index, headMatrix);
+            }
+
+            void trackerOrientationQ(float qw, float qx, float qy, float qz) override
+            {
+                {
+                    const juce::SpinLock::ScopedLockType sl(matrixLock);
+                    headMatrix.setOrientationQuaternion(qw, qx, qy, qz);
+                }
+                registry.notifyOrientation(index, headMatrix);
+            }
+
+            void trackerOrientationM(float* matrix) override
+            {
+                {
+                    const juce::SpinLock::ScopedLockType sl(matrixLock);
+                    headMatrix.setOrientationMatrix(matrix);
+                }
+                registry.notifyOrientation(index, headMatrix);
+            }
+
+            void trackerMidiConnectionChanged(Midi::State state) override
+            {
+                registry.connectionChanged(*this, state);
+            }
+
+            juce::String getListenerName() const override
+            {
+                return "Registry device " + juce::String(index);
+            }
+
+            TrackerRegistry& registry;
+            const int index;
+            const juce::String identifier;
+            juce::SpinLock matrixLock; // held while the MIDI thread writes headMatrix
+            HeadMatrix headMatrix;
+            TrackerDriver driver; // last, so that it stops first
+        };
+
+        juce::String deviceName;
+        std::vector<std::unique_ptr<Device>> devices;
+        juce::HashMap<juce::String, int> indices;
+        SubscriberList<Listener, 1> listeners; // every listener hears everything
+        bool is100Hz, isQuaternionMode, isStreaming;
+        std::atomic<bool> devicesHaveChanged;
+        SharedDeviceWatcher deviceWatcher;
+
+        // ------------------------------------------------------------------------
+
+        bool isTrackerName(const juce::String& name) const
+        {
+            // Windows numbers extra devices with the same name: "2- Head Tracker MIDI 1"
+            return name.endsWith(deviceName);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void addDevice(const juce::String& inputIdentifier, const juce::String& outputIdentifier)
+        {
+            const int index = getNumDevices();
+            devices.push_back(std::unique_ptr<Device>(new Device(*this, index, inputIdentifier)));
+            indices.set(inputIdentifier, index);
+
+            Device& d = *devices.back();
+            d.driver.addListener(&d, TrackerDriver::OrientationEvents |
+                TrackerDriver::eventMask(TrackerDriver::Event::MidiConnection));
+            d.driver.setInputBackend(InputBackend::AlsaReactor);
+            d.driver.setDeviceIdentifiers(outputIdentifier, inputIdentifier);
+            d.driver.setAutoReconnect(true);
+            listeners.call(0, [index](Listener* l) { l->trackerDeviceAdded(index); });
+        }
+
+        // ------------------------------------------------------------------------
+
+        void notifyOrientation(const int index, const HeadMatrix& headMatrix)
+        {
+            listeners.call(0, [index, &headMatrix](Listener* l) { l->trackerDeviceOrientation(index, headMatrix); });
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Takes the device itself, which never moves, rather than an index
+            into devices. */
+        void connectionChanged(Device& device, const Midi::State state)
+        {
+            JUCE_ASSERT_MESSAGE_THREAD
+            const int index = device.index;
+            if ((state == State::Connected) && isStreaming)
+            {
+                device.driver.turnOn(is100Hz, isQuaternionMode);
+            }
+            listeners.call(0, [index, state](Listener* l) { l->trackerDeviceConnectionChanged(index, state); });
+        }
+
+        // ------------------------------------------------------------------------
+
+        void timerCallback() override
+        {
+            devicesHaveChanged = false;
+            refresh();
+            startTimer(deviceWatcher->isWatching() ? FallbackPollMilliseconds : PollMilliseconds);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void midiDevicesChanged() override
+        {
+            // called on the watcher thread: look for new devices promptly on the message thread
+            if (!devicesHaveChanged.exchange(true))
+            {
+                startTimer(1);
+            }
+        }
+    };
+};
@@ -0,0 +1,120 @@
+/*
+ * MIDI drivers
+ * An event that can be signalled without taking a lock
+ * Copyright (c) 2021 Supperware Ltd.
+ */
+
+#pragma once
+
+#if JUCE_LINUX
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#elif JUCE_MAC || JUCE_IOS
+#include <dispatch/dispatch.h>
+#endif
+
+namespace Midi
+{
+    /** Wakes a sleeping thread, from a thread that mustn't wait for a lock.
+        On Linux it's an eventfd, and signal() is one write() to it; on macOS
+        it's a dispatch semaphore, which only enters the kernel when a thread
+        is asleep on it. Neither takes a lock that the sleeper could be
+        holding. Elsewhere it falls back to a juce::WaitableEvent, whose
+        signal() takes a lock, briefly.
+
+        Signals aren't counted exactly: one or more signals before a wait()
+        make it return straight away, and a signal nobody was waiting for can
+        wake a later wait() early, so callers check their own condition again
+        when it returns. */
+    class WakeEvent
+    {
+    public:
+#if JUCE_LINUX
+        WakeEvent() :
+            fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+            jassert(fd >= 0);
+        }
+
+        ~WakeEvent()
+        {
+            if (fd >= 0) ::close(fd);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void signal()
+        {
+            const uint64_t one = 1;
+            juce::ignoreUnused(::write(fd, &one, sizeof(one)));
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Waits for a signal, or for the timeout; -1 waits indefinitely. */
+        void wait(const int milliseconds)
+        {
+            pollfd p { fd, POLLIN, 0 };
+            if (::poll(&p, 1, milliseconds) > 0)
+            {
+                uint64_t count;
+                juce::ignoreUnused(::read(fd, &count, sizeof(count))); // resets it
+            }
+        }
+
+    private:
+        const int fd;
+#elif JUCE_MAC || JUCE_IOS
+        WakeEvent() :
+            semaphore(dispatch_semaphore_create(0))
+        {}
+
+        ~WakeEvent()
+        {
+            dispatch_release(semaphore);
+        }
+
+        // ------------------------------------------------------------------------
+
+        void signal()
+        {
+            dispatch_semaphore_signal(semaphore);
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Waits for a signal, or for the timeout; -1 waits indefinitely. */
+        void wait(const int milliseconds)
+        {
+            dispatch_semaphore_wait(semaphore, (milliseconds < 0) ? DISPATCH_TIME_FOREVER :
+                dispatch_time(DISPATCH_TIME_NOW, static_cast<int64_t>(milliseconds) * NSEC_PER_MSEC));
+        }
+
+    private:
+        dispatch_semaphore_t semaphore;
+#else
+        WakeEvent() {}
+
+        // ------------------------------------------------------------------------
+
+        void signal()
+        {
+            event.signal();
+        }
+
+        // ------------------------------------------------------------------------
+
+        /** Waits for a signal, or for the timeout; -1 waits indefinitely. */
+        void wait(const int milliseconds)
+        {
+            event.wait(milliseconds);
+        }
+
+    private:
+        juce::WaitableEvent event;
+#endif
+
+        JUCE_DECLARE_NON_COPYABLE(WakeEvent)
+    };
+};
@@ -6,5 +6,22 @@
 #pragma once
 #define MIDI_H_INCLUDED
 
+#include "midi-DeviceWatcher.h"
+#include "midi-SysexParser.h"
+#include "midi-IngestionThread.h"
+#include "midi-AlsaSeqInput.h"
+#include "midi-AlsaReactor.h"
+#include "midi-JackInput.h"
+#include "midi-FrameQueue.h"
+#include "midi-LoopbackPort.h"
 #include "midi-MidiDuplex.h"
+#include "midi-CommandQueue.h"
+#include "midi-MessageBank.h"
+#include "midi-SubscriberList.h"
+#include "midi-WakeEvent.h"
 #include "midi-TrackerDriver.h"
+#include "midi-QueuedListener.h"
+#include "midi-BatchedListener.h"
+#include "midi-TrackerRegistry.h"
+#include "midi-TrackerHub.h"
+#include "midi-SimulatedTracker.h"
@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    Turns a simulated head quickly and then holds it still, and checks that
+    TrackerDriver's adaptive rate moves the stream to 100Hz and back.
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+
+class AdaptiveRateTests : public juce::UnitTest
+{
+public:
+    AdaptiveRateTests() : juce::UnitTest("Adaptive rate", "Driver") {}
+
+    void runTest() override
+    {
+        beginTest("Starts at 50Hz");
+        Midi::SimulatedTracker sim;
+        std::unique_ptr<Midi::TrackerDriver> driver;
+        TestHelpers::callOnMessageThread([&]
+        {
+            driver.reset(new Midi::TrackerDriver());
+            driver->setLoopbackPort(&sim);
+            driver->turnOn(false, true);
+            driver->setAdaptiveRate(true);
+        });
+        expect(TestHelpers::waitUntil([&sim] { return sim.getNumFramesSent() > 0; }, WaitMilliseconds), "no frames");
+        expect(!sim.is100Hz());
+
+        beginTest("Fast turns switch to 100Hz");
+        // peaks at 2 pi radians a second: far above the 60 degree threshold
+        sim.setSyntheticMotion(1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+        expect(TestHelpers::waitUntil([&sim] { return sim.is100Hz(); }, WaitMilliseconds), "stayed at 50Hz");
+        expect(driver->getMotionRate().isFastRate());
+
+        beginTest("Holding still switches back to 50Hz");
+        sim.setSyntheticMotion(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+        // one second's hold, and then the next frame
+        expect(TestHelpers::waitUntil([&sim] { return !sim.is100Hz(); }, WaitMilliseconds + 1000), "stayed at 100Hz");
+
+        beginTest("Statistics");
+        const MotionRate& rate = driver->getMotionRate();
+        logMessage(juce::String(rate.getSecondsAt100Hz(), 2) + " s at 100Hz, " + juce::String(rate.getSecondsAt50Hz(), 2)
+            + " s at 50Hz, " + juce::String(static_cast<int>(rate.getNumSwitches())) + " switches");
+        expectGreaterOrEqual(static_cast<int>(rate.getNumSwitches()), 2);
+        expectGreaterThan(rate.getSecondsAt100Hz(), 0.5);
+        expectGreaterThan(rate.getSecondsAt50Hz(), 0.0);
+
+        TestHelpers::callOnMessageThread([&driver] { driver = nullptr; });
+    }
+
+private:
+    static constexpr int WaitMilliseconds = 2000;
+};
+
+static AdaptiveRateTests adaptiveRateTests;
@@ -0,0 +1,72 @@
+/*
+  ==============================================================================
+
+    Compares per-frame latency and jitter through JUCE's MIDI input and
+    through the native ALSA sequencer backend, from a virtual port.
+
+  ==============================================================================
+*/
+
+#include "TimingDuplex.h"
+
+#if JUCE_LINUX
+class AlsaInputBenchmark : public juce::UnitTest
+{
+public:
+    AlsaInputBenchmark() : juce::UnitTest("ALSA input backend", "ALSA") {}
+
+    void runTest() override
+    {
+        VirtualPort port;
+        if (!port.open(PortName))
+        {
+            beginTest("Latency and jitter");
+            logMessage("No ALSA sequencer here: skipped");
+            return;
+        }
+
+        measure(port, Midi::InputBackend::Juce, "JUCE");
+        measure(port, Midi::InputBackend::AlsaSequencer, "ALSA sequencer");
+    }
+
+private:
+    static constexpr const char* PortName = "Supperware Test Port";
+    static constexpr int NumFrames = 1000;
+    static constexpr int FrameMilliseconds = 2;
+
+    // ------------------------------------------------------------------------
+
+    void measure(VirtualPort& port, const Midi::InputBackend backend, const juce::String& name)
+    {
+        beginTest("Latency and jitter: " + name);
+        std::unique_ptr<TimingDuplex> duplex;
+        bool isConnected = false;
+        Midi::InputBackend activeBackend = Midi::InputBackend::Juce;
+        TestHelpers::callOnMessageThread([&]
+        {
+            duplex.reset(new TimingDuplex(PortName));
+            duplex->setInputBackend(backend);
+            isConnected = duplex->connect();
+            activeBackend = duplex->getActiveInputBackend();
+        });
+        expect(isConnected, "couldn't connect");
+        expect(activeBackend == backend, "connected through another backend");
+        // give the input a moment to subscribe
+        juce::Thread::sleep(100);
+
+        for (int i = 0; i < NumFrames; ++i)
+        {
+            duplex->sendFrame(port, i);
+            juce::Thread::sleep(FrameMilliseconds);
+        }
+        juce::Thread::sleep(100);
+
+        const TimingDuplex::Stats stats = duplex->getStats(NumFrames);
+        TestHelpers::callOnMessageThread([&duplex] { duplex = nullptr; });
+        logMessage(name + ": " + TimingDuplex::describe(stats));
+        expectEquals(stats.numReceived, NumFrames);
+    }
+};
+
+static AlsaInputBenchmark alsaInputBenchmark;
+#endif
@@ -0,0 +1,118 @@
+/*
+  ==============================================================================
+
+    Plugs and unplugs a virtual ALSA port, and times how long a MidiDuplex
+    with automatic reconnection takes to notice each.
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+#include "VirtualPort.h"
+
+#if JUCE_LINUX
+class DeviceWatcherTests : public juce::UnitTest
+{
+public:
+    DeviceWatcherTests() : juce::UnitTest("Device watcher", "ALSA") {}
+
+    void runTest() override
+    {
+        beginTest("Plug to connected");
+        VirtualPort port;
+        if (!port.open(PortName))
+        {
+            logMessage("No ALSA sequencer here: skipped");
+            return;
+        }
+        port.close();
+
+        std::unique_ptr<WatchedDuplex> duplex;
+        TestHelpers::callOnMessageThread([&duplex]
+        {
+            duplex.reset(new WatchedDuplex());
+            // nothing is sent, so only the device list can say it's gone
+            duplex->setExpectedTrafficInterval(0);
+            duplex->setAutoReconnect(true);
+        });
+        juce::Thread::sleep(SettleMilliseconds);
+        expect(duplex->getLastState() == Midi::State::Unavailable);
+
+        const double plugMs = juce::Time::getMillisecondCounterHiRes();
+        expect(port.open(PortName));
+        const double connectedMs = duplex->waitFor(Midi::State::Connected, WaitMilliseconds);
+        expect(connectedMs > 0.0, "never connected");
+        const double plugLatency = connectedMs - plugMs;
+        logMessage("Plug to connected: " + juce::String(plugLatency, 1) + " ms");
+        expectLessThan(plugLatency, static_cast<double>(MaxLatencyMilliseconds));
+
+        beginTest("Unplug to unavailable");
+        const double unplugMs = juce::Time::getMillisecondCounterHiRes();
+        port.close();
+        const double goneMs = duplex->waitFor(Midi::State::Unavailable, WaitMilliseconds);
+        expect(goneMs > 0.0, "never noticed the unplug");
+        const double unplugLatency = goneMs - unplugMs;
+        logMessage("Unplug to unavailable: " + juce::String(unplugLatency, 1) + " ms");
+        expectLessThan(unplugLatency, static_cast<double>(MaxLatencyMilliseconds));
+
+        TestHelpers::callOnMessageThread([&duplex] { duplex = nullptr; });
+    }
+
+private:
+    static constexpr const char* PortName = "Supperware Test Port";
+    static constexpr int SettleMilliseconds = 200;
+    static constexpr int WaitMilliseconds = 8000;
+    /** Well inside the 600ms enumeration poll that a missing watcher falls back to. */
+    static constexpr int MaxLatencyMilliseconds = 300;
+
+    // ------------------------------------------------------------------------
+
+    /** Notes when it reaches each state. State changes arrive on the message
+        thread; the test waits on its own. */
+    class WatchedDuplex : public Midi::MidiDuplex
+    {
+    public:
+        WatchedDuplex() :
+            Midi::MidiDuplex(PortName, "Supperware Test Bootloader"),
+            lastState(static_cast<int>(Midi::State::Unavailable)),
+            lastChangeMs(0.0)
+        {}
+
+        /** The state as of the last change, from any thread. */
+        Midi::State getLastState() const
+        {
+            return static_cast<Midi::State>(lastState.load());
+        }
+
+        /** Returns the time it reached the state, or 0 if it didn't in time. */
+        double waitFor(const Midi::State state, const int timeoutMilliseconds)
+        {
+            const double endMs = juce::Time::getMillisecondCounterHiRes() + timeoutMilliseconds;
+            while (juce::Time::getMillisecondCounterHiRes() < endMs)
+            {
+                if (lastState == static_cast<int>(state))
+                {
+                    return lastChangeMs;
+                }
+                changed.wait(10);
+            }
+            return 0.0;
+        }
+
+    protected:
+        void connectionStateChanged() override
+        {
+            lastChangeMs = juce::Time::getMillisecondCounterHiRes();
+            lastState = static_cast<int>(getConnectionState());
+            changed.signal();
+        }
+
+    private:
+        std::atomic<int> lastState;
+        std::atomic<double> lastChangeMs;
+        juce::WaitableEvent changed;
+    };
+};
+
+static DeviceWatcherTests deviceWatcherTests;
+#endif
@@ -0,0 +1,67 @@
+/*
+  ==============================================================================
+
+    Unit tests and benchmarks for the Supperware Head Tracker API.
+
+    Run it with no arguments for every test, or with a category:
+    "Benchmarks" times the audio and MIDI paths, and "ALSA" needs a
+    sequencer (/dev/snd/seq) to make virtual ports in. Benchmark results
+    are printed along with the test log. Returns 1 if anything failed.
+
+  ==============================================================================
+*/
+
+#include "TestIncludes.h"
+
+//==============================================================================
+/** The tests run on a thread of their own, so that the message thread is free
+    to deliver timer callbacks, just as it would in an app. */
+class TestThread : public juce::Thread
+{
+public:
+    TestThread(const juce::String& testCategory) :
+        juce::Thread("Tests"),
+        category(testCategory),
+        numFailures(0)
+    {}
+
+    int getNumFailures() const
+    {
+        return numFailures;
+    }
+
+    void run() override
+    {
+        juce::UnitTestRunner runner;
+        runner.setAssertOnFailure(false);
+        if (category.isEmpty())
+        {
+            runner.runAllTests();
+        }
+        else
+        {
+            runner.runTestsInCategory(category);
+        }
+
+        for (int i = 0; i < runner.getNumResults(); ++i)
+        {
+            numFailures += runner.getResult(i)->failures;
+        }
+        juce::MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+private:
+    juce::String category;
+    std::atomic<int> numFailures;
+};
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    TestThread tests((argc > 1) ? juce::String(argv[1]) : juce::String());
+    tests.startThread();
+    juce::MessageManager::getInstance()->runDispatchLoop();
+    tests.stopThread(-1);
+    return (tests.getNumFailures() > 0) ? 1 : 0;
+}
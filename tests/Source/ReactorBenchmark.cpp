@@ -0,0 +1,132 @@
+/*
+  ==============================================================================
+
+    Drives 1 to 64 simulated trackers at 100Hz, through the AlsaReactor (one
+    thread for all of them) and through the AlsaSequencer backend (a thread
+    each), and compares CPU use and per-frame latency.
+
+  ==============================================================================
+*/
+
+#include "TimingDuplex.h"
+
+#if JUCE_LINUX
+#include <sys/resource.h>
+#include <time.h>
+
+class ReactorBenchmark : public juce::UnitTest
+{
+public:
+    ReactorBenchmark() : juce::UnitTest("ALSA reactor", "ALSA") {}
+
+    void runTest() override
+    {
+        {
+            VirtualPort probe;
+            if (!probe.open("Supperware Test Probe"))
+            {
+                beginTest("Scaling");
+                logMessage("No ALSA sequencer here: skipped");
+                return;
+            }
+        }
+
+        for (const int numTrackers : { 1, 4, 16, 64 })
+        {
+            measure(numTrackers, Midi::InputBackend::AlsaSequencer, "a thread each");
+            measure(numTrackers, Midi::InputBackend::AlsaReactor, "reactor");
+        }
+    }
+
+private:
+    static constexpr int NumFrames = 200;
+    static constexpr int FrameMilliseconds = 10;
+
+    // ------------------------------------------------------------------------
+
+    void measure(const int numTrackers, const Midi::InputBackend backend, const juce::String& name)
+    {
+        beginTest(juce::String(numTrackers) + " trackers, " + name);
+        std::vector<std::unique_ptr<VirtualPort>> ports;
+        std::vector<std::unique_ptr<TimingDuplex>> duplexes;
+        for (int i = 0; i < numTrackers; ++i)
+        {
+            ports.emplace_back(new VirtualPort());
+            expect(ports.back()->open(getPortName(i)));
+        }
+
+        int numConnected = 0;
+        TestHelpers::callOnMessageThread([&]
+        {
+            for (int i = 0; i < numTrackers; ++i)
+            {
+                duplexes.emplace_back(new TimingDuplex(getPortName(i)));
+                duplexes.back()->setInputBackend(backend);
+                if (duplexes.back()->connect() && (duplexes.back()->getActiveInputBackend() == backend))
+                {
+                    ++numConnected;
+                }
+            }
+        });
+        expectEquals(numConnected, numTrackers);
+        juce::Thread::sleep(100);
+
+        // the sending is done here, and this thread's CPU isn't counted
+        const double processStart = getProcessSeconds();
+        const double senderStart = getThreadSeconds();
+        const double wallStart = juce::Time::getMillisecondCounterHiRes();
+        for (int f = 0; f < NumFrames; ++f)
+        {
+            for (int i = 0; i < numTrackers; ++i)
+            {
+                duplexes[static_cast<size_t>(i)]->sendFrame(*ports[static_cast<size_t>(i)], f);
+            }
+            juce::Thread::sleep(FrameMilliseconds);
+        }
+        juce::Thread::sleep(50);
+        const double wallSeconds = (juce::Time::getMillisecondCounterHiRes() - wallStart) * 0.001;
+        const double receiveSeconds = (getProcessSeconds() - processStart) - (getThreadSeconds() - senderStart);
+
+        int numReceived = 0;
+        double p50 = 0.0, p99 = 0.0, worst = 0.0;
+        for (const std::unique_ptr<TimingDuplex>& d : duplexes)
+        {
+            const TimingDuplex::Stats stats = d->getStats(NumFrames);
+            numReceived += stats.numReceived;
+            p50 = juce::jmax(p50, stats.p50Ms);
+            p99 = juce::jmax(p99, stats.p99Ms);
+            worst = juce::jmax(worst, stats.maxMs);
+        }
+        TestHelpers::callOnMessageThread([&duplexes] { duplexes.clear(); });
+
+        logMessage(juce::String(numTrackers) + " trackers, " + name + ": "
+            + juce::String(100.0 * receiveSeconds / wallSeconds, 2) + "% of a core; worst tracker p50 "
+            + juce::String(p50, 3) + " ms, p99 " + juce::String(p99, 3) + " ms, max " + juce::String(worst, 3) + " ms");
+        expectEquals(numReceived, numTrackers * NumFrames);
+    }
+
+    // ------------------------------------------------------------------------
+
+    static juce::String getPortName(const int index)
+    {
+        return "Supperware Test Port " + juce::String(index + 1);
+    }
+
+    static double getProcessSeconds()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+            + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+    }
+
+    static double getThreadSeconds()
+    {
+        timespec t;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+        return static_cast<double>(t.tv_sec) + static_cast<double>(t.tv_nsec) * 1e-9;
+    }
+};
+
+static ReactorBenchmark reactorBenchmark;
+#endif
@@ -0,0 +1,142 @@
+/*
+  ==============================================================================
+
+    Checks AmbisonicRotator, and measures its throughput for orders 1 to 5,
+    in channels x samples per microsecond.
+
+  ==============================================================================
+*/
+
+#include "TestIncludes.h"
+
+class RotatorBenchmark : public juce::UnitTest
+{
+public:
+    RotatorBenchmark() : juce::UnitTest("Ambisonic rotator", "Benchmarks") {}
+
+    void runTest() override
+    {
+        beginTest("Identity leaves the field alone");
+        {
+            Audio::AmbisonicRotator rotator;
+            rotator.prepare(AmbisonicMatrix::MaxOrder, BlockSize);
+            juce::AudioBuffer<float> buffer(rotator.getNumChannels(), BlockSize);
+            fillNoise(buffer);
+            juce::AudioBuffer<float> original(buffer);
+            HeadMatrix headMatrix;
+            rotator.process(buffer, headMatrix);
+            expectLessThan(maxDifference(buffer, original), 1.0e-6f);
+        }
+
+        beginTest("Rotation keeps each order's energy");
+        {
+            Audio::AmbisonicRotator rotator;
+            rotator.prepare(AmbisonicMatrix::MaxOrder, BlockSize);
+            juce::AudioBuffer<float> buffer(rotator.getNumChannels(), BlockSize);
+            HeadMatrix headMatrix;
+            headMatrix.setOrientationYPR(0.7f, -0.3f, 0.2f);
+            // the first block crossfades to the new orientation; the second doesn't
+            fillNoise(buffer);
+            rotator.process(buffer, headMatrix);
+            fillNoise(buffer);
+            juce::AudioBuffer<float> original(buffer);
+            rotator.process(buffer, headMatrix);
+            for (int l = 0; l <= AmbisonicMatrix::MaxOrder; ++l)
+            {
+                const float before = orderEnergy(original, l);
+                expectWithinAbsoluteError(orderEnergy(buffer, l), before, before * 1.0e-4f);
+            }
+        }
+
+        beginTest("Throughput");
+        for (int order = 1; order <= AmbisonicMatrix::MaxOrder; ++order)
+        {
+            const double still = measure(order, false);
+            const double moving = measure(order, true);
+            logMessage("Order " + juce::String(order) + " (" + juce::String(AmbisonicMatrix::getNumChannels(order))
+                + " channels): " + juce::String(still, 1) + " channel-samples/us still, "
+                + juce::String(moving, 1) + " while the head moves");
+            expectGreaterThan(moving, 0.0);
+        }
+    }
+
+private:
+    static constexpr int BlockSize = 256;
+    static constexpr int NumBlocks = 4000;
+
+    // ------------------------------------------------------------------------
+
+    /** Channel-samples per microsecond. Moving turns the head every block, so
+        every block crossfades. */
+    double measure(const int order, const bool isMoving)
+    {
+        Audio::AmbisonicRotator rotator;
+        rotator.prepare(order, BlockSize);
+        juce::AudioBuffer<float> buffer(rotator.getNumChannels(), BlockSize);
+        fillNoise(buffer);
+        HeadMatrix headMatrix;
+        headMatrix.setOrientationYPR(0.5f, 0.1f, 0.0f);
+        rotator.process(buffer, headMatrix);
+
+        const int64_t startTicks = juce::Time::getHighResolutionTicks();
+        for (int i = 0; i < NumBlocks; ++i)
+        {
+            if (isMoving)
+            {
+                headMatrix.setOrientationYPR(0.5f + 0.001f * static_cast<float>(i & 1), 0.1f, 0.0f);
+            }
+            rotator.process(buffer, headMatrix);
+        }
+        const double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        const double channelSamples = static_cast<double>(rotator.getNumChannels()) * BlockSize * NumBlocks;
+        return channelSamples / (seconds * 1.0e6);
+    }
+
+    // ------------------------------------------------------------------------
+
+    void fillNoise(juce::AudioBuffer<float>& buffer)
+    {
+        juce::Random& random = getRandom();
+        for (int c = 0; c < buffer.getNumChannels(); ++c)
+        {
+            float* d = buffer.getWritePointer(c);
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+            {
+                d[i] = random.nextFloat() * 2.0f - 1.0f;
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    static float maxDifference(const juce::AudioBuffer<float>& a, const juce::AudioBuffer<float>& b)
+    {
+        float m = 0.0f;
+        for (int c = 0; c < a.getNumChannels(); ++c)
+        {
+            for (int i = 0; i < a.getNumSamples(); ++i)
+            {
+                m = juce::jmax(m, std::abs(a.getSample(c, i) - b.getSample(c, i)));
+            }
+        }
+        return m;
+    }
+
+    // ------------------------------------------------------------------------
+
+    static float orderEnergy(const juce::AudioBuffer<float>& buffer, const int l)
+    {
+        float e = 0.0f;
+        const int first = AmbisonicMatrix::getFirstChannel(l);
+        for (int c = first; c < first + 2 * l + 1; ++c)
+        {
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+            {
+                e += buffer.getSample(c, i) * buffer.getSample(c, i);
+            }
+        }
+        return e;
+    }
+};
+
+static RotatorBenchmark rotatorBenchmark;
@@ -0,0 +1,141 @@
+/*
+  ==============================================================================
+
+    Counts the heap allocations TrackerDriver's sender thread makes while it
+    sends commands. The global operator new is replaced for the whole test
+    program, but only counts on the sender thread, and only while a test is
+    counting.
+
+    What's measured is the driver's own path, from the command queue to
+    MidiDuplex::sendMessage: the port here is a loopback that keeps nothing.
+    A real juce::MidiOutput may allocate inside the operating system's MIDI
+    API, which this can't see.
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<bool> isCounting { false };
+    std::atomic<int> numAllocations { 0 };
+    thread_local bool isSenderThread = false;
+
+    void* allocate(const size_t size)
+    {
+        if (isSenderThread && isCounting)
+        {
+            ++numAllocations;
+        }
+        if (void* p = std::malloc(size ? size : 1))
+        {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(size_t size)                     { return allocate(size); }
+void* operator new[](size_t size)                   { return allocate(size); }
+void operator delete(void* p) noexcept              { std::free(p); }
+void operator delete[](void* p) noexcept            { std::free(p); }
+void operator delete(void* p, size_t) noexcept      { std::free(p); }
+void operator delete[](void* p, size_t) noexcept    { std::free(p); }
+
+//==============================================================================
+class SenderAllocationTests : public juce::UnitTest
+{
+public:
+    SenderAllocationTests() : juce::UnitTest("Sender allocations", "Driver") {}
+
+    void runTest() override
+    {
+        beginTest("Steady-state commands don't allocate");
+        CountingPort port;
+        std::unique_ptr<Midi::TrackerDriver> driver;
+        TestHelpers::callOnMessageThread([&]
+        {
+            driver.reset(new Midi::TrackerDriver());
+            // the port never replies, so the watchdog mustn't be waiting for it
+            driver->setAutoDisconnect(false);
+            driver->setLoopbackPort(&port);
+            driver->connect();
+        });
+        // the restore sequence ends with a readback
+        expect(TestHelpers::waitUntil([&port] { return port.getNumMessages() >= 1; }, WaitMilliseconds));
+
+        // once through everything first, as an app would have done at startup
+        sendBurst(*driver, port, true);
+
+        isCounting = true;
+        for (int i = 0; i < NumBursts; ++i)
+        {
+            sendBurst(*driver, port, (i & 1) != 0);
+        }
+        // let the sender finish the last burst while it's still being counted
+        juce::Thread::sleep(50);
+        isCounting = false;
+
+        logMessage(juce::String(port.getNumMessages()) + " messages sent, "
+            + juce::String(numAllocations.load()) + " allocations on the sender thread");
+        expectEquals(numAllocations.load(), 0);
+        expectEquals(static_cast<int>(driver->getUnbankedSends()), 0);
+        expectEquals(static_cast<int>(driver->getDroppedCommands()), 0);
+
+        TestHelpers::callOnMessageThread([&driver] { driver = nullptr; });
+    }
+
+private:
+    static constexpr int NumBursts = 200;
+    static constexpr int WaitMilliseconds = 2000;
+
+    // ------------------------------------------------------------------------
+
+    /** Swallows everything, and marks the thread that sends to it. */
+    class CountingPort : public Midi::LoopbackPort
+    {
+    public:
+        CountingPort() : numMessages(0) {}
+
+        void openLoopback(Midi::SysexParser::Listener* /*receiver*/) override {}
+        void closeLoopback() override {}
+
+        void loopbackMessage(const uint8_t* /*data*/, const size_t /*numBytes*/) override
+        {
+            isSenderThread = true;
+            ++numMessages;
+        }
+
+        int getNumMessages() const
+        {
+            return numMessages;
+        }
+
+    private:
+        std::atomic<int> numMessages;
+    };
+
+    // ------------------------------------------------------------------------
+
+    /** Every kind of command, from this thread, and then waits until the
+        sender has sent some of them. */
+    void sendBurst(Midi::TrackerDriver& driver, CountingPort& port, const bool alternate)
+    {
+        const int before = port.getNumMessages();
+        driver.turnOn(alternate, !alternate);
+        driver.zero();
+        driver.setChirality(alternate);
+        driver.setTravelMode(alternate ? Tracker::TravelMode::Slow : Tracker::TravelMode::Off);
+        driver.setCompass(alternate, !alternate);
+        driver.calibrateCompass();
+        driver.turnOff();
+        // commands can be coalesced, but at least the last one goes
+        expect(TestHelpers::waitUntil([&port, before] { return port.getNumMessages() > before; }, WaitMilliseconds));
+        juce::Thread::sleep(2);
+    }
+};
+
+static SenderAllocationTests senderAllocationTests;
@@ -0,0 +1,47 @@
+/*
+  ==============================================================================
+
+    Small things the tests share.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "TestIncludes.h"
+
+namespace TestHelpers
+{
+    /** Runs a function on the message thread, and waits for it. Drivers are
+        made, set up and destroyed there, as they would be in an app, so that
+        their timers never run alongside a test thread's calls. */
+    inline void callOnMessageThread(std::function<void()> function)
+    {
+        juce::WaitableEvent done;
+        juce::MessageManager::callAsync([&function, &done]
+        {
+            function();
+            done.signal();
+        });
+        done.wait(-1);
+    }
+
+    // ----------------------------------------------------------------------------
+
+    /** Polls the condition every millisecond until it's true, or the timeout
+        passes. Returns the condition's last value. */
+    template <typename Condition>
+    bool waitUntil(Condition condition, const int timeoutMilliseconds)
+    {
+        const uint32_t endMs = juce::Time::getMillisecondCounter() + static_cast<uint32_t>(timeoutMilliseconds);
+        while (!condition())
+        {
+            if (static_cast<int32_t>(juce::Time::getMillisecondCounter() - endMs) >= 0)
+            {
+                return condition();
+            }
+            juce::Thread::sleep(1);
+        }
+        return true;
+    }
+};
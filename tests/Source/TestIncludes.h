@@ -0,0 +1,26 @@
+/*
+  ==============================================================================
+
+    Unit tests and benchmarks for the Supperware Head Tracker API.
+    Every test includes the API through here, in the order it needs.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "HeadMatrix.h"
+#include "Tracker.h"
+#include "FirmwareTransfer.h"
+#include "FrameClock.h"
+#include "TrackerSimulator.h"
+#include "GazeTargets.h"
+#include "AmbisonicMatrix.h"
+#include "VbapLayout.h"
+#include "Interaural.h"
+#include "LatencyHistogram.h"
+#include "MotionRate.h"
+#include "midi.h"
+#include "audio.h"
@@ -0,0 +1,109 @@
+/*
+  ==============================================================================
+
+    A MidiDuplex that times numbered sysex frames from a VirtualPort, for the
+    input benchmarks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "TestHelpers.h"
+#include "VirtualPort.h"
+
+#if JUCE_LINUX
+class TimingDuplex : public Midi::MidiDuplex
+{
+public:
+    struct Stats
+    {
+        int numReceived;
+        double meanMs, p50Ms, p99Ms, maxMs, jitterMs; // jitter is the standard deviation
+    };
+
+    /** Up to MaxFrames frames can be timed. */
+    static constexpr int MaxFrames = 16384;
+
+    /** Make it on the message thread. */
+    TimingDuplex(const juce::String& portName) :
+        Midi::MidiDuplex(portName, portName + " bootloader"),
+        sentMs(new std::atomic<double>[MaxFrames]),
+        latencyMs(new std::atomic<double>[MaxFrames])
+    {
+        // the benchmarks connect and disconnect by hand
+        setAutoReconnect(false);
+        setAutoDisconnect(false);
+        for (int i = 0; i < MaxFrames; ++i)
+        {
+            sentMs[i] = 0.0;
+            latencyMs[i] = -1.0;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Stamps frame number index, and sends it from the port. */
+    void sendFrame(VirtualPort& port, const int index)
+    {
+        jassert((index >= 0) && (index < MaxFrames));
+        const uint8_t frame[] = { 0xF0, 0x7D, static_cast<uint8_t>((index >> 7) & 0x7F),
+            static_cast<uint8_t>(index & 0x7F), 0, 0, 0, 0, 0, 0, 0, 0, 0xF7 };
+        sentMs[index] = juce::Time::getMillisecondCounterHiRes();
+        port.sendSysex(frame, sizeof(frame));
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Latency statistics over the first numSent frames. */
+    Stats getStats(const int numSent) const
+    {
+        std::vector<double> latencies;
+        for (int i = 0; i < numSent; ++i)
+        {
+            if (latencyMs[i] >= 0.0)
+            {
+                latencies.push_back(latencyMs[i]);
+            }
+        }
+
+        Stats stats { static_cast<int>(latencies.size()), 0.0, 0.0, 0.0, 0.0, 0.0 };
+        if (latencies.empty()) return stats;
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0.0, sumSquares = 0.0;
+        for (const double l : latencies)
+        {
+            sum += l;
+            sumSquares += l * l;
+        }
+        const double n = static_cast<double>(latencies.size());
+        stats.meanMs = sum / n;
+        stats.p50Ms = latencies[latencies.size() / 2];
+        stats.p99Ms = latencies[(latencies.size() * 99) / 100];
+        stats.maxMs = latencies.back();
+        stats.jitterMs = std::sqrt(juce::jmax(0.0, sumSquares / n - stats.meanMs * stats.meanMs));
+        return stats;
+    }
+
+    // ------------------------------------------------------------------------
+
+    static juce::String describe(const Stats& s)
+    {
+        return juce::String(s.numReceived) + " frames, mean " + juce::String(s.meanMs, 3)
+            + " ms, p50 " + juce::String(s.p50Ms, 3) + " ms, p99 " + juce::String(s.p99Ms, 3)
+            + " ms, max " + juce::String(s.maxMs, 3) + " ms, jitter " + juce::String(s.jitterMs, 3) + " ms";
+    }
+
+protected:
+    /** On whichever thread the backend reads from. */
+    void handleSysEx(const uint8_t* data, const size_t numBytes) override
+    {
+        if ((numBytes < 3) || (data[0] != 0x7D)) return;
+        const int index = (data[1] << 7) | data[2];
+        latencyMs[index] = juce::Time::getMillisecondCounterHiRes() - sentMs[index];
+    }
+
+private:
+    std::unique_ptr<std::atomic<double>[]> sentMs, latencyMs;
+};
+#endif
@@ -0,0 +1,96 @@
+/*
+  ==============================================================================
+
+    An ALSA sequencer port that stands in for a device, so that tests can
+    plug and unplug it, and send to whatever connects to it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "TestIncludes.h"
+
+#if JUCE_LINUX
+#include <alsa/asoundlib.h>
+
+class VirtualPort
+{
+public:
+    VirtualPort() :
+        seq(nullptr),
+        port(-1)
+    {}
+
+    ~VirtualPort()
+    {
+        close();
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Appears in the MIDI device lists under portName. Returns false if the
+        sequencer isn't available (in a container, say). */
+    bool open(const juce::String& portName)
+    {
+        close();
+        if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0)
+        {
+            seq = nullptr;
+            return false;
+        }
+        snd_seq_set_client_name(seq, "Supperware test port");
+        port = snd_seq_create_simple_port(seq, portName.toRawUTF8(),
+            SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ |
+            SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+            SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        if (port < 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Unplugs it. */
+    void close()
+    {
+        if (seq)
+        {
+            snd_seq_close(seq);
+            seq = nullptr;
+        }
+        port = -1;
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool isOpen() const
+    {
+        return seq != nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /** Sends a complete sysex message (F0 ... F7) to every subscriber. */
+    void sendSysex(const uint8_t* data, const size_t numBytes)
+    {
+        if (!seq) return;
+        snd_seq_event_t event;
+        snd_seq_ev_clear(&event);
+        snd_seq_ev_set_source(&event, port);
+        snd_seq_ev_set_subs(&event);
+        snd_seq_ev_set_direct(&event);
+        snd_seq_ev_set_sysex(&event, static_cast<unsigned int>(numBytes), const_cast<uint8_t*>(data));
+        snd_seq_event_output_direct(seq, &event);
+    }
+
+private:
+    snd_seq_t* seq;
+    int port;
+
+    JUCE_DECLARE_NON_COPYABLE(VirtualPort)
+};
+#endif